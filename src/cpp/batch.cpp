@@ -0,0 +1,987 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+// projectorrays-batch: runs the entry points from main.cpp over whole directory trees of Director
+// files. Every file gets its own handle on one of the pool's threads, and a single NDJSON record
+// describing it is written as soon as it has been processed. Bulky results (script dumps,
+// unprotected files, catalogs) can be collected into one tar archive instead of the records.
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "projectorrays.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+#define BATCH_STRINGIFY_(x) #x
+#define BATCH_STRINGIFY(x) BATCH_STRINGIFY_(x)
+
+enum BatchOperation : uint32_t {
+    kOpChunks = 1 << 0,
+    kOpCatalog = 1 << 1,
+    kOpScripts = 1 << 2,
+    kOpUnprotect = 1 << 3,
+};
+
+struct BatchOptions {
+    uint32_t operations = kOpChunks;
+    unsigned threads = 0;
+    bool incremental = false;
+    std::string outputPath;
+    std::string archivePath;
+    std::vector<std::string> listPaths;
+    std::vector<std::string> inputs;
+};
+
+struct BatchTask {
+    fs::path path;
+    // Index of the input the file came from followed by its path relative to that input, used to
+    // name the archive entries. The index keeps inputs with overlapping file names apart.
+    std::string name;
+    uintmax_t size = 0;
+};
+
+using Clock = std::chrono::steady_clock;
+
+using Buffer = std::unique_ptr<uint8_t, void (*)(uint8_t *)>;
+
+class Handle {
+public:
+    Handle() = default;
+    ~Handle() { reset(0); }
+    Handle(const Handle &) = delete;
+    Handle &operator=(const Handle &) = delete;
+
+    uintptr_t get() const { return id_; }
+    void reset(uintptr_t id) {
+        if (id_) {
+            projectorrays_free_handle(id_);
+        }
+        id_ = id;
+    }
+
+private:
+    uintptr_t id_ = 0;
+};
+
+double millisecondsSince(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+uint32_t readUint32LE(const uint8_t *data) {
+    return static_cast<uint32_t>(data[0]) | (static_cast<uint32_t>(data[1]) << 8) |
+           (static_cast<uint32_t>(data[2]) << 16) | (static_cast<uint32_t>(data[3]) << 24);
+}
+
+std::string fourCCString(uint32_t fourCC) {
+    std::string out;
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        out += static_cast<char>((fourCC >> shift) & 0xff);
+    }
+    return out;
+}
+
+void appendJsonString(std::string &out, const std::string &value) {
+    out += '"';
+    for (unsigned char c : value) {
+        switch (c) {
+        case '"':
+            out += "\\\"";
+            break;
+        case '\\':
+            out += "\\\\";
+            break;
+        case '\n':
+            out += "\\n";
+            break;
+        case '\r':
+            out += "\\r";
+            break;
+        case '\t':
+            out += "\\t";
+            break;
+        default:
+            if (c < 0x20 || c == 0x7f) {
+                char escaped[7];
+                std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                out += escaped;
+            } else {
+                out += static_cast<char>(c);
+            }
+            break;
+        }
+    }
+    out += '"';
+}
+
+void appendJsonNumber(std::string &out, double value) {
+    char text[32];
+    std::snprintf(text, sizeof(text), "%.3f", value);
+    out += text;
+}
+
+// Strip the whitespace between tokens so a pretty-printed document fits on one NDJSON line.
+std::string compactJson(const char *data, size_t size) {
+    std::string out;
+    out.reserve(size);
+    bool inString = false;
+    bool escaped = false;
+    for (size_t i = 0; i < size; ++i) {
+        const char c = data[i];
+        if (inString) {
+            out += c;
+            if (escaped) {
+                escaped = false;
+            } else if (c == '\\') {
+                escaped = true;
+            } else if (c == '"') {
+                inString = false;
+            }
+        } else if (c == '"') {
+            inString = true;
+            out += c;
+        } else if (c != ' ' && c != '\n' && c != '\r' && c != '\t') {
+            out += c;
+        }
+    }
+    return out;
+}
+
+bool isDirectorExtension(const fs::path &path) {
+    std::string ext = path.extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return ext == ".dir" || ext == ".dxr" || ext == ".dcr" || ext == ".cst" || ext == ".cxt" ||
+           ext == ".cct";
+}
+
+// Directories are searched recursively for Director files. Anything else is taken as-is, so a
+// missing or unreadable path becomes a failed record rather than aborting the batch.
+void collectInput(const std::string &input, size_t rootIndex, std::vector<BatchTask> &tasks) {
+    const fs::path root(input);
+    const std::string prefix = std::to_string(rootIndex) + "/";
+    std::error_code ec;
+    if (!fs::is_directory(root, ec)) {
+        BatchTask task;
+        task.path = root;
+        task.name = prefix + root.filename().generic_string();
+        task.size = fs::file_size(root, ec);
+        if (ec) {
+            task.size = 0;
+        }
+        tasks.push_back(std::move(task));
+        return;
+    }
+
+    fs::recursive_directory_iterator it(root, fs::directory_options::skip_permission_denied, ec);
+    for (const fs::recursive_directory_iterator end; !ec && it != end; it.increment(ec)) {
+        const fs::directory_entry &entry = *it;
+        std::error_code entryEc;
+        if (!entry.is_regular_file(entryEc) || !isDirectorExtension(entry.path())) {
+            continue;
+        }
+        BatchTask task;
+        task.path = entry.path();
+        task.name = prefix + entry.path().lexically_relative(root).generic_string();
+        task.size = entry.file_size(entryEc);
+        if (entryEc) {
+            task.size = 0;
+        }
+        tasks.push_back(std::move(task));
+    }
+    if (ec) {
+        std::cerr << "projectorrays-batch: " << input << ": " << ec.message() << "\n";
+    }
+}
+
+bool collectList(const std::string &listPath, size_t &rootIndex, std::vector<BatchTask> &tasks) {
+    std::ifstream file;
+    std::istream *stream = &std::cin;
+    if (listPath != "-") {
+        file.open(listPath);
+        if (!file) {
+            return false;
+        }
+        stream = &file;
+    }
+    std::string line;
+    while (std::getline(*stream, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (!line.empty()) {
+            collectInput(line, rootIndex++, tasks);
+        }
+    }
+    return true;
+}
+
+// Drops every task whose file was already reached through an earlier input, e.g. a directory
+// given both on its own and inside its parent, so no file is processed or archived twice.
+void removeDuplicateTasks(std::vector<BatchTask> &tasks) {
+    std::set<fs::path> seen;
+    std::vector<BatchTask> unique;
+    unique.reserve(tasks.size());
+    for (auto &task : tasks) {
+        std::error_code ec;
+        fs::path key = fs::weakly_canonical(task.path, ec);
+        if (ec) {
+            key = fs::absolute(task.path, ec).lexically_normal();
+        }
+        if (seen.insert(std::move(key)).second) {
+            unique.push_back(std::move(task));
+        }
+    }
+    tasks.swap(unique);
+}
+
+// A fixed set of tasks spread over one deque per thread. Workers take from the front of their own
+// deque and, once it runs dry, steal from the back of the others, so a thread held up by one huge
+// movie doesn't leave the files queued behind it waiting.
+class WorkStealingPool {
+public:
+    WorkStealingPool(size_t taskCount, unsigned threadCount) {
+        threadCount = std::max(threadCount, 1u);
+        for (unsigned i = 0; i < threadCount; ++i) {
+            queues_.push_back(std::make_unique<Queue>());
+        }
+        for (size_t task = 0; task < taskCount; ++task) {
+            queues_[task % threadCount]->tasks.push_back(task);
+        }
+    }
+
+    void run(const std::function<void(size_t)> &work) {
+        std::vector<std::thread> threads;
+        for (size_t self = 1; self < queues_.size(); ++self) {
+            threads.emplace_back([this, self, &work]() { drain(self, work); });
+        }
+        drain(0, work);
+        for (auto &thread : threads) {
+            thread.join();
+        }
+    }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<size_t> tasks;
+    };
+
+    bool take(size_t self, size_t &task) {
+        {
+            Queue &own = *queues_[self];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty()) {
+                task = own.tasks.front();
+                own.tasks.pop_front();
+                return true;
+            }
+        }
+        for (size_t offset = 1; offset < queues_.size(); ++offset) {
+            Queue &victim = *queues_[(self + offset) % queues_.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = victim.tasks.back();
+                victim.tasks.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void drain(size_t self, const std::function<void(size_t)> &work) {
+        size_t task;
+        // No task ever queues more work, so once every deque is empty the pool is done.
+        while (take(self, task)) {
+            work(task);
+        }
+    }
+
+    std::vector<std::unique_ptr<Queue>> queues_;
+};
+
+// Minimal ustar writer. Names that don't fit the header get a pax extended header in front.
+class TarWriter {
+public:
+    bool open(const std::string &path) {
+        file_ = std::fopen(path.c_str(), "wb");
+        return file_ != nullptr;
+    }
+
+    bool add(const std::string &name, const uint8_t *data, size_t size) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!file_ || failed_) {
+            return false;
+        }
+        if (name.size() > 100) {
+            std::string record = " path=" + name + "\n";
+            // The length prefix counts its own digits.
+            size_t length = record.size();
+            std::string prefix = std::to_string(length);
+            while (std::to_string(length + prefix.size()) != prefix) {
+                prefix = std::to_string(length + prefix.size());
+            }
+            record = prefix + record;
+            writeEntry("PaxHeader", 'x', reinterpret_cast<const uint8_t *>(record.data()),
+                       record.size());
+        }
+        writeEntry(name.substr(0, 100), '0', data, size);
+        return !failed_;
+    }
+
+    bool close() {
+        if (!file_) {
+            return true;
+        }
+        static const uint8_t zeros[1024] = {};
+        if (std::fwrite(zeros, 1, sizeof(zeros), file_) != sizeof(zeros)) {
+            failed_ = true;
+        }
+        if (std::fclose(file_) != 0) {
+            failed_ = true;
+        }
+        file_ = nullptr;
+        return !failed_;
+    }
+
+private:
+    static void writeOctal(char *field, size_t width, uint64_t value) {
+        std::snprintf(field, width, "%0*llo", static_cast<int>(width - 1),
+                      static_cast<unsigned long long>(value));
+    }
+
+    void writeEntry(const std::string &name, char type, const uint8_t *data, size_t size) {
+        char header[512] = {};
+        std::memcpy(header, name.data(), std::min<size_t>(name.size(), 100));
+        writeOctal(header + 100, 8, 0644);
+        writeOctal(header + 108, 8, 0);
+        writeOctal(header + 116, 8, 0);
+        writeOctal(header + 124, 12, size);
+        writeOctal(header + 136, 12, 0);
+        std::memset(header + 148, ' ', 8);
+        header[156] = type;
+        std::memcpy(header + 257, "ustar", 6);
+        std::memcpy(header + 263, "00", 2);
+
+        unsigned checksum = 0;
+        for (unsigned char c : header) {
+            checksum += c;
+        }
+        std::snprintf(header + 148, 8, "%06o", checksum);
+        header[155] = ' ';
+
+        static const uint8_t padding[512] = {};
+        const size_t paddingSize = (512 - size % 512) % 512;
+        if (std::fwrite(header, 1, sizeof(header), file_) != sizeof(header) ||
+            (size > 0 && std::fwrite(data, 1, size, file_) != size) ||
+            std::fwrite(padding, 1, paddingSize, file_) != paddingSize) {
+            failed_ = true;
+        }
+    }
+
+    std::FILE *file_ = nullptr;
+    std::mutex mutex_;
+    bool failed_ = false;
+};
+
+class RecordWriter {
+public:
+    explicit RecordWriter(std::FILE *file) : file_(file) {}
+
+    void write(const std::string &record) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::fwrite(record.data(), 1, record.size(), file_);
+        std::fputc('\n', file_);
+        std::fflush(file_);
+    }
+
+private:
+    std::FILE *file_;
+    std::mutex mutex_;
+};
+
+// Each operation appends `"key":{...}` to the record and returns whether it succeeded. A failed
+// operation doesn't stop the others from running on the same file.
+
+bool runChunks(uintptr_t handle, std::string &record) {
+    const auto start = Clock::now();
+    size_t size = 0;
+    Buffer list(projectorrays_list_chunks(handle, &size), projectorrays_free);
+    record += "\"chunks\":{\"ms\":";
+    appendJsonNumber(record, millisecondsSince(start));
+    if (!list || size < 4) {
+        record += ",\"ok\":false}";
+        return false;
+    }
+
+    const uint32_t count = readUint32LE(list.get());
+    record += ",\"ok\":true,\"count\":" + std::to_string(count) + ",\"list\":[";
+    for (uint32_t i = 0; i < count && 4 + (i + 1) * 12 <= size; ++i) {
+        const uint8_t *entry = list.get() + 4 + i * 12;
+        if (i > 0) {
+            record += ',';
+        }
+        record += "{\"fourCC\":";
+        appendJsonString(record, fourCCString(readUint32LE(entry)));
+        record += ",\"id\":" + std::to_string(static_cast<int32_t>(readUint32LE(entry + 4)));
+        record += ",\"size\":" + std::to_string(readUint32LE(entry + 8)) + "}";
+    }
+    record += "]}";
+    return true;
+}
+
+// Decodes the columns laid out by projectorrays_cast_catalog into `"columns":{...}` with one array
+// per column plus the member names, followed by `"castNames":[...]`. Returns false if the buffer
+// is shorter than its header claims or a name offset points outside the string pool.
+bool appendCatalogJson(std::string &out, const uint8_t *data, size_t size) {
+    const uint64_t rows = readUint32LE(data);
+    const uint64_t casts = readUint32LE(data + 4);
+    const uint64_t stringsSize = readUint32LE(data + 8);
+    auto padded = [](uint64_t bytes) { return (bytes + 3) & ~uint64_t(3); };
+    if (12 + rows * 28 + padded(rows) * 5 + (rows + 1) * 4 + (casts + 1) * 4 +
+            padded(stringsSize) >
+        size) {
+        return false;
+    }
+
+    const uint8_t *cursor = data + 12;
+    auto take = [&](uint64_t bytes) {
+        const uint8_t *column = cursor;
+        cursor += bytes;
+        return column;
+    };
+    const uint8_t *memberId = take(rows * 4);
+    const uint8_t *castIndex = take(rows * 4);
+    const uint8_t *type = take(padded(rows));
+    const uint8_t *scriptType = take(padded(rows));
+    const uint8_t *width = take(rows * 4);
+    const uint8_t *height = take(rows * 4);
+    const uint8_t *depth = take(padded(rows));
+    const uint8_t *soundMedia = take(rows * 4);
+    const uint8_t *soundFormat = take(rows * 4);
+    const uint8_t *sampleRate = take(rows * 4);
+    const uint8_t *sampleSize = take(padded(rows));
+    const uint8_t *channelCount = take(padded(rows));
+    const uint8_t *nameOffsets = take((rows + 1) * 4);
+    const uint8_t *castNameOffsets = take((casts + 1) * 4);
+    const char *strings = reinterpret_cast<const char *>(cursor);
+
+    bool first = true;
+    auto beginArray = [&](const char *key) {
+        out += first ? "" : ",";
+        first = false;
+        out += '"';
+        out += key;
+        out += "\":[";
+    };
+    auto int32Column = [&](const char *key, const uint8_t *column) {
+        beginArray(key);
+        for (uint64_t i = 0; i < rows; ++i) {
+            out += (i > 0 ? "," : "");
+            out += std::to_string(static_cast<int32_t>(readUint32LE(column + i * 4)));
+        }
+        out += ']';
+    };
+    auto uint8Column = [&](const char *key, const uint8_t *column) {
+        beginArray(key);
+        for (uint64_t i = 0; i < rows; ++i) {
+            out += (i > 0 ? "," : "");
+            out += std::to_string(column[i]);
+        }
+        out += ']';
+    };
+    auto stringColumn = [&](const char *key, const uint8_t *offsets, uint64_t count) {
+        beginArray(key);
+        for (uint64_t i = 0; i < count; ++i) {
+            const uint32_t begin = readUint32LE(offsets + i * 4);
+            const uint32_t end = readUint32LE(offsets + (i + 1) * 4);
+            if (begin > end || end > stringsSize) {
+                return false;
+            }
+            out += (i > 0 ? "," : "");
+            appendJsonString(out, std::string(strings + begin, end - begin));
+        }
+        out += ']';
+        return true;
+    };
+
+    out += "\"columns\":{";
+    int32Column("memberId", memberId);
+    int32Column("castIndex", castIndex);
+    uint8Column("type", type);
+    uint8Column("scriptType", scriptType);
+    int32Column("width", width);
+    int32Column("height", height);
+    uint8Column("depth", depth);
+    // fourCCs and OSTypes read better as text, like the chunk list's fourCCs.
+    auto fourCCColumn = [&](const char *key, const uint8_t *column) {
+        beginArray(key);
+        for (uint64_t i = 0; i < rows; ++i) {
+            out += (i > 0 ? "," : "");
+            const uint32_t fourCC = readUint32LE(column + i * 4);
+            if (fourCC) {
+                appendJsonString(out, fourCCString(fourCC));
+            } else {
+                out += "null";
+            }
+        }
+        out += ']';
+    };
+    fourCCColumn("soundMedia", soundMedia);
+    fourCCColumn("soundFormat", soundFormat);
+    int32Column("sampleRate", sampleRate);
+    uint8Column("sampleSize", sampleSize);
+    uint8Column("channelCount", channelCount);
+    if (!stringColumn("name", nameOffsets, rows)) {
+        return false;
+    }
+    out += "},";
+    first = true;
+    return stringColumn("castNames", castNameOffsets, casts);
+}
+
+bool runCatalog(uintptr_t handle, const BatchTask &task, TarWriter *archive, std::string &record) {
+    const auto start = Clock::now();
+    size_t size = 0;
+    Buffer catalog(projectorrays_cast_catalog(handle, &size), projectorrays_free);
+    bool ok = catalog && size >= 12;
+    std::string entry;
+    std::string inlined;
+    if (ok && archive) {
+        entry = task.name + ".catalog.bin";
+        ok = archive->add(entry, catalog.get(), size);
+    } else if (ok) {
+        ok = appendCatalogJson(inlined, catalog.get(), size);
+    }
+    record += "\"catalog\":{\"ms\":";
+    appendJsonNumber(record, millisecondsSince(start));
+    record += ok ? ",\"ok\":true" : ",\"ok\":false";
+    if (catalog && size >= 12) {
+        record += ",\"members\":" + std::to_string(readUint32LE(catalog.get()));
+        record += ",\"casts\":" + std::to_string(readUint32LE(catalog.get() + 4));
+        record += ",\"bytes\":" + std::to_string(size);
+    }
+    if (ok && archive) {
+        record += ",\"entry\":";
+        appendJsonString(record, entry);
+    } else if (ok) {
+        record += ',' + inlined;
+    }
+    record += '}';
+    return ok;
+}
+
+bool runScripts(uintptr_t handle, const BatchTask &task, TarWriter *archive, std::string &record) {
+    const auto start = Clock::now();
+    size_t size = 0;
+    Buffer scripts(projectorrays_implemented_dump_scripts(handle, &size), projectorrays_free);
+    bool ok = scripts != nullptr;
+    std::string entry;
+    std::string inlined;
+    if (ok && archive) {
+        entry = task.name + ".scripts.json";
+        ok = archive->add(entry, scripts.get(), size);
+    } else if (ok) {
+        inlined = compactJson(reinterpret_cast<const char *>(scripts.get()), size);
+    }
+    record += "\"scripts\":{\"ms\":";
+    appendJsonNumber(record, millisecondsSince(start));
+    record += ok ? ",\"ok\":true" : ",\"ok\":false";
+    if (scripts) {
+        record += ",\"bytes\":" + std::to_string(size);
+    }
+    if (ok && archive) {
+        record += ",\"entry\":";
+        appendJsonString(record, entry);
+    } else if (ok) {
+        record += ",\"result\":" + inlined;
+    }
+    record += '}';
+    return ok;
+}
+
+bool runUnprotect(uintptr_t handle, const BatchTask &task, const BatchOptions &options,
+                  TarWriter *archive, std::string &record) {
+    const auto start = Clock::now();
+    const bool isCast = projectorrays_is_cast(handle) != 0;
+    size_t size = 0;
+    Buffer output(options.incremental
+                      ? projectorrays_write_incremental(handle,
+                                                        kWriteUnprotect | kWriteRestoreScriptText,
+                                                        &size)
+                      : projectorrays_implemented_write_to_buffer(handle, &size),
+                  projectorrays_free);
+    bool ok = output != nullptr;
+    std::string entry;
+    if (ok && archive) {
+        // Appended rather than replaced, so movie.dir and movie.dxr don't both become movie.dir.
+        entry = task.name + (isCast ? ".cst" : ".dir");
+        ok = archive->add(entry, output.get(), size);
+    }
+    record += "\"unprotect\":{\"ms\":";
+    appendJsonNumber(record, millisecondsSince(start));
+    record += ok ? ",\"ok\":true" : ",\"ok\":false";
+    if (output) {
+        record += ",\"bytes\":" + std::to_string(size);
+    }
+    if (ok && archive) {
+        record += ",\"entry\":";
+        appendJsonString(record, entry);
+    }
+    record += '}';
+    return ok;
+}
+
+// Reads the file straight into the input buffer of a new handle, so that it is held in memory only
+// once instead of being read into a buffer of our own and then copied by projectorrays_read. An
+// empty file leaves `handle` empty.
+bool readFile(const fs::path &path, Handle &handle, uint64_t &size) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    file.seekg(0, std::ios::end);
+    const std::streamoff length = file.tellg();
+    if (length < 0) {
+        return false;
+    }
+    file.seekg(0, std::ios::beg);
+    size = static_cast<uint64_t>(length);
+    if (size == 0) {
+        return true;
+    }
+    uintptr_t id = 0;
+    uint8_t *input = projectorrays_alloc_input(static_cast<size_t>(size), &id);
+    handle.reset(id);
+    return input && file.read(reinterpret_cast<char *>(input), length).good();
+}
+
+// Runs every selected operation on one file and returns its NDJSON record. `bytesRead` is the
+// input size, counted towards throughput even when parsing fails.
+std::string processFile(const BatchTask &task, const BatchOptions &options, TarWriter *archive,
+                        bool &ok, uint64_t &bytesRead) {
+    const auto start = Clock::now();
+    std::string record = "{\"path\":";
+    appendJsonString(record, task.path.generic_string());
+    ok = false;
+    bytesRead = 0;
+
+    auto finish = [&](const char *error) {
+        record += ok ? ",\"ok\":true" : ",\"ok\":false";
+        if (error) {
+            record += ",\"error\":";
+            appendJsonString(record, error);
+        }
+        record += ",\"ms\":";
+        appendJsonNumber(record, millisecondsSince(start));
+        record += '}';
+        return record;
+    };
+
+    Handle handle;
+    uint64_t size = 0;
+    const auto readStart = Clock::now();
+    if (!readFile(task.path, handle, size)) {
+        return finish("could not read file");
+    }
+    bytesRead = size;
+    record += ",\"bytes\":" + std::to_string(size);
+    record += ",\"readMs\":";
+    appendJsonNumber(record, millisecondsSince(readStart));
+
+    const auto parseStart = Clock::now();
+    const bool parsed = handle.get() && projectorrays_read_input(handle.get());
+    record += ",\"parseMs\":";
+    appendJsonNumber(record, millisecondsSince(parseStart));
+    if (!parsed) {
+        return finish("not a readable Director file");
+    }
+    record += projectorrays_is_cast(handle.get()) ? ",\"isCast\":true" : ",\"isCast\":false";
+
+    // Unprotecting rewrites the parsed file in place, so it goes last.
+    ok = true;
+    if (options.operations & kOpChunks) {
+        record += ',';
+        ok = runChunks(handle.get(), record) && ok;
+    }
+    if (options.operations & kOpCatalog) {
+        record += ',';
+        ok = runCatalog(handle.get(), task, archive, record) && ok;
+    }
+    if (options.operations & kOpScripts) {
+        record += ',';
+        ok = runScripts(handle.get(), task, archive, record) && ok;
+    }
+    if (options.operations & kOpUnprotect) {
+        record += ',';
+        ok = runUnprotect(handle.get(), task, options, archive, record) && ok;
+    }
+    return finish(ok ? nullptr : "one or more operations failed");
+}
+
+bool parseOperations(const std::string &list, uint32_t &operations) {
+    operations = 0;
+    size_t begin = 0;
+    while (begin <= list.size()) {
+        size_t end = list.find(',', begin);
+        if (end == std::string::npos) {
+            end = list.size();
+        }
+        const std::string name = list.substr(begin, end - begin);
+        if (name == "chunks") {
+            operations |= kOpChunks;
+        } else if (name == "catalog") {
+            operations |= kOpCatalog;
+        } else if (name == "scripts") {
+            operations |= kOpScripts;
+        } else if (name == "unprotect") {
+            operations |= kOpUnprotect;
+        } else if (name == "all") {
+            operations |= kOpChunks | kOpCatalog | kOpScripts | kOpUnprotect;
+        } else if (!name.empty()) {
+            return false;
+        }
+        begin = end + 1;
+    }
+    return operations != 0;
+}
+
+void printUsage(std::ostream &out) {
+    out << "Usage: projectorrays-batch [options] <file|directory>...\n"
+           "\n"
+           "Reads every Director file given, or found under the given directories, on a pool of\n"
+           "threads and writes one NDJSON record per file followed by a summary record.\n"
+           "\n"
+           "Options:\n"
+           "  --ops <list>        Comma-separated operations: chunks, catalog, scripts,\n"
+           "                      unprotect, or all (default: chunks)\n"
+           "  -j, --jobs <n>      Number of worker threads (default: all cores)\n"
+           "  --list <file>       Read more inputs from <file>, one per line ('-' for stdin)\n"
+           "  -o, --output <file> Write the NDJSON records to <file> instead of stdout\n"
+           "  --archive <file>    Store script dumps, catalogs and unprotected files in a tar\n"
+           "                      archive instead of inlining them in the records (required\n"
+           "                      for unprotect)\n"
+           "  --incremental       Unprotect with the incremental writer\n"
+           "  -h, --help          Show this help\n"
+           "  -v, --version       Show the version\n";
+}
+
+// Returns -1 to continue, otherwise the exit code.
+int parseArguments(int argc, char **argv, BatchOptions &options) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        auto value = [&](std::string &out) {
+            if (i + 1 >= argc) {
+                std::cerr << "projectorrays-batch: " << arg << " requires a value\n";
+                return false;
+            }
+            out = argv[++i];
+            return true;
+        };
+
+        std::string text;
+        if (arg == "-h" || arg == "--help") {
+            printUsage(std::cout);
+            return 0;
+        } else if (arg == "-v" || arg == "--version") {
+#ifdef VERSION_NUMBER
+            std::cout << "projectorrays-batch " BATCH_STRINGIFY(VERSION_NUMBER)
+#ifdef GIT_SHA
+                         " (" BATCH_STRINGIFY(GIT_SHA) ")"
+#endif
+                      << "\n";
+#else
+            std::cout << "projectorrays-batch\n";
+#endif
+            return 0;
+        } else if (arg == "--ops") {
+            if (!value(text)) {
+                return 2;
+            }
+            if (!parseOperations(text, options.operations)) {
+                std::cerr << "projectorrays-batch: unknown operation list '" << text << "'\n";
+                return 2;
+            }
+        } else if (arg == "-j" || arg == "--jobs") {
+            if (!value(text)) {
+                return 2;
+            }
+            char *end = nullptr;
+            const long jobs = std::strtol(text.c_str(), &end, 10);
+            if (!end || *end != '\0' || jobs < 1) {
+                std::cerr << "projectorrays-batch: invalid job count '" << text << "'\n";
+                return 2;
+            }
+            options.threads = static_cast<unsigned>(jobs);
+        } else if (arg == "--list") {
+            if (!value(text)) {
+                return 2;
+            }
+            options.listPaths.push_back(text);
+        } else if (arg == "-o" || arg == "--output") {
+            if (!value(options.outputPath)) {
+                return 2;
+            }
+        } else if (arg == "--archive") {
+            if (!value(options.archivePath)) {
+                return 2;
+            }
+        } else if (arg == "--incremental") {
+            options.incremental = true;
+        } else if (arg == "--") {
+            for (++i; i < argc; ++i) {
+                options.inputs.push_back(argv[i]);
+            }
+        } else if (arg.size() > 1 && arg[0] == '-') {
+            std::cerr << "projectorrays-batch: unknown option " << arg << "\n";
+            printUsage(std::cerr);
+            return 2;
+        } else {
+            options.inputs.push_back(arg);
+        }
+    }
+
+    if (options.inputs.empty() && options.listPaths.empty()) {
+        printUsage(std::cerr);
+        return 2;
+    }
+    // Unprotected files are whole movies, which have no place in an NDJSON record.
+    if ((options.operations & kOpUnprotect) && options.archivePath.empty()) {
+        std::cerr << "projectorrays-batch: unprotect requires --archive\n";
+        return 2;
+    }
+    return -1;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    BatchOptions options;
+    const int exitCode = parseArguments(argc, argv, options);
+    if (exitCode >= 0) {
+        return exitCode;
+    }
+
+    std::vector<BatchTask> tasks;
+    size_t rootIndex = 0;
+    for (const auto &input : options.inputs) {
+        collectInput(input, rootIndex++, tasks);
+    }
+    for (const auto &listPath : options.listPaths) {
+        if (!collectList(listPath, rootIndex, tasks)) {
+            std::cerr << "projectorrays-batch: could not read list " << listPath << "\n";
+            return 2;
+        }
+    }
+    removeDuplicateTasks(tasks);
+    // Largest first, so the big files start early and the small ones fill in the gaps.
+    std::stable_sort(tasks.begin(), tasks.end(),
+                     [](const BatchTask &a, const BatchTask &b) { return a.size > b.size; });
+
+    std::FILE *output = stdout;
+    if (!options.outputPath.empty()) {
+        output = std::fopen(options.outputPath.c_str(), "wb");
+        if (!output) {
+            std::cerr << "projectorrays-batch: could not open " << options.outputPath << "\n";
+            return 2;
+        }
+    }
+
+    std::unique_ptr<TarWriter> archive;
+    if (!options.archivePath.empty()) {
+        archive = std::make_unique<TarWriter>();
+        if (!archive->open(options.archivePath)) {
+            std::cerr << "projectorrays-batch: could not open " << options.archivePath << "\n";
+            return 2;
+        }
+    }
+
+    unsigned threads = options.threads ? options.threads : std::thread::hardware_concurrency();
+    threads = static_cast<unsigned>(
+        std::max<size_t>(1, std::min<size_t>(threads ? threads : 1, tasks.size())));
+
+    RecordWriter records(output);
+    std::mutex totalsMutex;
+    size_t failures = 0;
+    uint64_t totalBytes = 0;
+
+    const auto start = Clock::now();
+    WorkStealingPool pool(tasks.size(), threads);
+    pool.run([&](size_t index) {
+        bool ok = false;
+        uint64_t bytesRead = 0;
+        std::string record;
+        try {
+            record = processFile(tasks[index], options, archive.get(), ok, bytesRead);
+        } catch (const std::exception &e) {
+            ok = false;
+            record = "{\"path\":";
+            appendJsonString(record, tasks[index].path.generic_string());
+            record += ",\"ok\":false,\"error\":";
+            appendJsonString(record, e.what());
+            record += '}';
+        }
+        records.write(record);
+
+        std::lock_guard<std::mutex> lock(totalsMutex);
+        totalBytes += bytesRead;
+        if (!ok) {
+            ++failures;
+        }
+    });
+    const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    bool archiveOk = true;
+    if (archive) {
+        archiveOk = archive->close();
+        if (!archiveOk) {
+            std::cerr << "projectorrays-batch: failed writing " << options.archivePath << "\n";
+        }
+    }
+
+    const double filesPerSecond = seconds > 0 ? tasks.size() / seconds : 0;
+    const double megabytesPerSecond = seconds > 0 ? totalBytes / 1e6 / seconds : 0;
+
+    std::string summary = "{\"summary\":{\"files\":" + std::to_string(tasks.size()) +
+                          ",\"failed\":" + std::to_string(failures) +
+                          ",\"bytes\":" + std::to_string(totalBytes) +
+                          ",\"threads\":" + std::to_string(threads) + ",\"seconds\":";
+    appendJsonNumber(summary, seconds);
+    summary += ",\"filesPerSecond\":";
+    appendJsonNumber(summary, filesPerSecond);
+    summary += ",\"megabytesPerSecond\":";
+    appendJsonNumber(summary, megabytesPerSecond);
+    summary += "}}";
+    records.write(summary);
+
+    if (output != stdout) {
+        std::fclose(output);
+    }
+
+    std::fprintf(stderr, "%zu files, %zu failed, %.2f s, %.1f files/s, %.1f MB/s\n", tasks.size(),
+                 failures, seconds, filesPerSecond, megabytesPerSecond);
+
+    return failures > 0 || !archiveOk ? 1 : 0;
+}
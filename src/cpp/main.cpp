@@ -4,12 +4,20 @@
  * file, You can obtain one at https://mozilla.org/MPL/2.0/.
  */
 
+#include <algorithm>
+#include <atomic>
 #include <cstddef>
 #include <cstdlib>
 #include <cstring>
+#include <functional>
+#include <map>
 #include <memory>
+#include <set>
+#include <thread>
 #include <vector>
 
+#include <zlib.h>
+
 #ifdef __EMSCRIPTEN__
 #include <emscripten/emscripten.h>
 #else
@@ -21,13 +29,25 @@
 #include "director/castmember.h"
 #include "director/chunk.h"
 #include "director/dirfile.h"
+#include "director/guid.h"
+
+#include "projectorrays.h"
 
 extern "C" {
 
+struct PatchedChunk {
+    uint32_t fourCC;
+    std::vector<uint8_t> data;
+};
+
 struct ProjectorRaysHandle {
     std::unique_ptr<Director::DirectorFile> dir;
     std::vector<uint8_t> input;
     std::unique_ptr<Common::ReadStream> stream;
+    // Pending edits made through projectorrays_set_chunk/projectorrays_remove_chunk. These are
+    // applied on top of the parsed file when reading raw chunks back and when writing.
+    std::map<int32_t, PatchedChunk> patchedChunks;
+    std::set<int32_t> removedChunks;
 };
 
 static ProjectorRaysHandle *handleFromId(uintptr_t handle) {
@@ -70,6 +90,40 @@ static std::string standardizeJsonEscapes(const std::string &input) {
     return out;
 }
 
+static std::string scriptTypeName(const Director::DirectorFile &dir,
+                                  const Director::CastMemberChunk *member) {
+    if (member->type != Director::kScriptMember) {
+        return "CastScript";
+    }
+    auto scriptMember = static_cast<Director::ScriptMember *>(member->member.get());
+    switch (scriptMember->scriptType) {
+    case Director::kScoreScript:
+        return (dir.version >= 600) ? "BehaviorScript" : "ScoreScript";
+    case Director::kMovieScript:
+        return "MovieScript";
+    case Director::kParentScript:
+        return "ParentScript";
+    default:
+        return "UnknownScript";
+    }
+}
+
+// One entry of the dump_scripts "scripts" array.
+static void writeScriptEntry(Common::JSONWriter &json, const Director::DirectorFile &dir,
+                             int32_t scriptId, Director::ScriptChunk *script,
+                             Director::CastMemberChunk *member) {
+    json.startObject();
+    json.writeField("scriptId", static_cast<int>(scriptId));
+    json.writeField("memberId", static_cast<int>(member->id));
+    json.writeField("memberName", member->getName());
+    json.writeField("scriptType", scriptTypeName(dir, member));
+    json.writeKey("lingo");
+    json.writeVal(script->scriptText("\n", dir.dotSyntax));
+    json.writeKey("bytecode");
+    json.writeVal(script->bytecodeText("\n", dir.dotSyntax));
+    json.endObject();
+}
+
 static bool writeDirectorToBuffer(Director::DirectorFile &dir, std::vector<uint8_t> &output) {
     dir.generateInitialMap();
     dir.generateMemoryMap();
@@ -102,233 +156,1229 @@ static bool writeDirectorToBuffer(Director::DirectorFile &dir, std::vector<uint8
     return true;
 }
 
-EMSCRIPTEN_KEEPALIVE uintptr_t projectorrays_read(const uint8_t *input, size_t inputSize) {
-    if (!input || inputSize == 0) {
-        return 0;
+// The file's chunk table (id -> fourCC) with the handle's pending edits applied.
+static std::map<int32_t, uint32_t> effectiveChunkTable(const ProjectorRaysHandle &handle) {
+    std::map<int32_t, uint32_t> table;
+    for (const auto &entry : handle.dir->chunkInfo) {
+        if (handle.removedChunks.count(entry.first)) {
+            continue;
+        }
+        table[entry.first] = entry.second.fourCC;
+    }
+    for (const auto &entry : handle.patchedChunks) {
+        table[entry.first] = entry.second.fourCC;
     }
+    return table;
+}
 
-    try {
-        auto handle = std::make_unique<ProjectorRaysHandle>();
-        handle->input.assign(input, input + inputSize);
-        handle->stream =
-            std::make_unique<Common::ReadStream>(handle->input.data(), handle->input.size());
-        handle->dir = std::make_unique<Director::DirectorFile>();
-        if (!handle->dir->read(handle->stream.get())) {
-            return 0;
+static bool findChunkView(ProjectorRaysHandle &handle, uint32_t fourCC, int32_t id,
+                          Common::BufferView &view) {
+    auto patched = handle.patchedChunks.find(id);
+    if (patched != handle.patchedChunks.end()) {
+        if (patched->second.fourCC != fourCC) {
+            return false;
         }
-        return reinterpret_cast<uintptr_t>(handle.release());
-    } catch (...) {
-        return 0;
+        view = Common::BufferView(patched->second.data.data(), patched->second.data.size());
+        return true;
     }
+    if (handle.removedChunks.count(id) || !handle.dir->chunkExists(fourCC, id)) {
+        return false;
+    }
+    view = handle.dir->getChunkData(fourCC, id);
+    return true;
 }
 
-EMSCRIPTEN_KEEPALIVE void projectorrays_free_handle(uintptr_t handle) {
-    auto *ptr = handleFromId(handle);
-    delete ptr;
-}
+// Internal to the write job: re-serialize every writable chunk that has been parsed, as
+// DirectorFile::write does, instead of only the chunks the other flags touch.
+static const uint32_t kWriteReserializeAll = 1u << 31;
+
+struct WriteChunk {
+    int32_t id;
+    uint32_t fourCC;
+    // Set by loadWriteChunk, or by beginWrite for a pending edit.
+    Common::BufferView data;
+    // Whether `data` differs from what the input file holds for this id.
+    bool modified;
+    // Whether loadWriteChunk re-serializes the parsed chunk rather than copying the input.
+    bool serialize;
+    // Whether `data` is a pending edit, copied by beginWrite.
+    bool pending;
+};
 
-EMSCRIPTEN_KEEPALIVE int projectorrays_chunk_exists(uintptr_t handle, uint32_t fourCC, int32_t id) {
-    if (!handle) {
-        return 0;
+// A write carried out one step at a time. beginWrite lists the work, restoreWriteScript parses
+// one script and restores its text, loadWriteChunk serializes or copies one output chunk, and a
+// writer then lays the chunks out. The synchronous writers run every step back to back
+// (loadWritePlan); the write job runs one step per unit.
+struct WritePlan {
+    std::vector<Director::ScriptChunk *> scripts;
+    // In the order they appear in the input, new chunks last. Ids 0-2 (the container, imap and
+    // mmap, or the ILS when the input is an Afterburner file) are left out as every writer
+    // regenerates them.
+    std::vector<WriteChunk> chunks;
+    // Indices into `chunks` that loadWriteChunk has to fill in. planAfterburnedWrite drops the
+    // ones whose compressed input bytes are copied as they are.
+    std::vector<size_t> loads;
+    // Output of the chunks that had to be re-serialized, and copies of the pending edits taken when
+    // the write began, referenced by `chunks`. The write job yields between steps, and an edit
+    // made meanwhile would otherwise reallocate or free the bytes a chunk still points to.
+    std::map<int32_t, std::vector<uint8_t>> serializedChunks;
+};
+
+static void beginWrite(ProjectorRaysHandle &handle, uint32_t flags, WritePlan &plan) {
+    Director::DirectorFile &dir = *handle.dir;
+
+    std::set<const Director::Chunk *> dirtyChunks;
+    if (flags & kWriteUnprotect) {
+        dir.config->unprotect();
+        dirtyChunks.insert(dir.config.get());
+    }
+    if (flags & kWriteRestoreScriptText) {
+        for (const auto &cast : dir.casts) {
+            if (!cast->lctx) {
+                continue;
+            }
+            for (const auto &entry : cast->lctx->scripts) {
+                auto scriptChunk = static_cast<Director::ScriptChunk *>(entry.second);
+                plan.scripts.push_back(scriptChunk);
+                if (scriptChunk->member) {
+                    dirtyChunks.insert(scriptChunk->member);
+                }
+            }
+        }
     }
 
-    try {
-        auto *ptr = handleFromId(handle);
-        if (!ptr || !ptr->dir) {
-            return 0;
+    struct OrderedChunk {
+        bool appended;
+        int32_t sourceOffset;
+        WriteChunk chunk;
+    };
+    std::vector<OrderedChunk> ordered;
+    for (const auto &entry : effectiveChunkTable(handle)) {
+        const int32_t id = entry.first;
+        const uint32_t fourCC = entry.second;
+        if (id <= 2 || fourCC == FOURCC('F', 'v', 'e', 'r') ||
+            fourCC == FOURCC('F', 'c', 'd', 'r') || fourCC == FOURCC('A', 'B', 'M', 'P') ||
+            fourCC == FOURCC('F', 'G', 'E', 'I')) {
+            continue;
         }
-        return ptr->dir->chunkExists(fourCC, id) ? 1 : 0;
-    } catch (...) {
-        return 0;
+
+        OrderedChunk ordering;
+        auto info = dir.chunkInfo.find(id);
+        ordering.appended = info == dir.chunkInfo.end();
+        ordering.sourceOffset = ordering.appended ? 0 : info->second.offset;
+
+        WriteChunk &chunk = ordering.chunk;
+        chunk.id = id;
+        chunk.fourCC = fourCC;
+        chunk.serialize = false;
+        auto patched = handle.patchedChunks.find(id);
+        chunk.pending = patched != handle.patchedChunks.end();
+        if (chunk.pending) {
+            std::vector<uint8_t> &copy = plan.serializedChunks[id];
+            copy = patched->second.data;
+            chunk.data = Common::BufferView(copy.data(), copy.size());
+        } else {
+            auto deserialized = dir.deserializedChunks.find(id);
+            if (deserialized != dir.deserializedChunks.end() && deserialized->second &&
+                deserialized->second->writable &&
+                ((flags & kWriteReserializeAll) || dirtyChunks.count(deserialized->second.get()))) {
+                chunk.serialize = true;
+            }
+        }
+        chunk.modified = ordering.appended || chunk.pending || chunk.serialize;
+
+        ordered.push_back(ordering);
     }
-}
 
-EMSCRIPTEN_KEEPALIVE int projectorrays_is_cast(uintptr_t handle) {
-    if (!handle) {
-        return 0;
+    // Keep the original chunk order so the output streams the same way the input did.
+    std::stable_sort(ordered.begin(), ordered.end(),
+                     [](const OrderedChunk &a, const OrderedChunk &b) {
+                         if (a.appended != b.appended) {
+                             return !a.appended;
+                         }
+                         return a.sourceOffset < b.sourceOffset;
+                     });
+
+    plan.chunks.clear();
+    plan.chunks.reserve(ordered.size());
+    plan.loads.clear();
+    for (const auto &ordering : ordered) {
+        plan.loads.push_back(plan.chunks.size());
+        plan.chunks.push_back(ordering.chunk);
     }
+}
 
-    try {
-        auto *ptr = handleFromId(handle);
-        if (!ptr || !ptr->dir) {
-            return 0;
-        }
-        return ptr->dir->isCast() ? 1 : 0;
-    } catch (...) {
-        return 0;
+// Decompile one script and store its text on the member, as DirectorFile::restoreScriptText does
+// for every script at once.
+static void restoreWriteScript(const Director::DirectorFile &dir, Director::ScriptChunk *script) {
+    script->parse();
+    if (script->member) {
+        script->member->setScriptText(script->scriptText("\r", dir.dotSyntax));
     }
 }
 
-EMSCRIPTEN_KEEPALIVE int projectorrays_size(uintptr_t handle) {
-    if (!handle) {
-        return 0;
+static bool loadWriteChunk(ProjectorRaysHandle &handle, WritePlan &plan, size_t index) {
+    WriteChunk &chunk = plan.chunks[index];
+    if (chunk.pending) {
+        return true;
     }
 
-    try {
-        auto *ptr = handleFromId(handle);
-        if (!ptr || !ptr->dir) {
-            return 0;
+    // Read from the parsed file rather than through findChunkView: an edit made after the write
+    // began must neither change its output nor leave `data` pointing into the edit's buffer.
+    Director::DirectorFile &dir = *handle.dir;
+    if (!chunk.serialize) {
+        chunk.data = dir.getChunkData(chunk.fourCC, chunk.id);
+        return true;
+    }
+
+    const auto &parsed = dir.deserializedChunks.at(chunk.id);
+    std::vector<uint8_t> &buffer = plan.serializedChunks[chunk.id];
+    buffer.assign(parsed->size(), 0);
+    Common::WriteStream stream(buffer.data(), buffer.size(), dir.endianness);
+    parsed->write(stream);
+    buffer.resize(stream.pos());
+    chunk.data = Common::BufferView(buffer.data(), buffer.size());
+    return true;
+}
+
+static bool loadWritePlan(ProjectorRaysHandle &handle, WritePlan &plan) {
+    for (Director::ScriptChunk *script : plan.scripts) {
+        restoreWriteScript(*handle.dir, script);
+    }
+    for (size_t index : plan.loads) {
+        if (!loadWriteChunk(handle, plan, index)) {
+            return false;
         }
-        return static_cast<int>(ptr->dir->size());
-    } catch (...) {
-        return 0;
     }
+    return true;
 }
 
-EMSCRIPTEN_KEEPALIVE uint8_t *projectorrays_get_chunk(uintptr_t handle, uint32_t fourCC, int32_t id,
-                                                      size_t *outputSize) {
-    if (!handle || !outputSize) {
-        return nullptr;
+static void appendVarInt(std::vector<uint8_t> &out, uint32_t value) {
+    // Director varints are big-endian groups of 7 bits with the high bit set on all but the last.
+    uint8_t groups[5];
+    size_t count = 0;
+    do {
+        groups[count++] = static_cast<uint8_t>(value & 0x7f);
+        value >>= 7;
+    } while (value);
+    while (count > 1) {
+        out.push_back(groups[--count] | 0x80);
     }
+    out.push_back(groups[0]);
+}
 
-    *outputSize = 0;
+static void appendUint16(std::vector<uint8_t> &out, uint16_t value, Common::Endianness endianness) {
+    uint8_t bytes[2];
+    Common::WriteStream stream(bytes, sizeof(bytes), endianness);
+    stream.writeUint16(value);
+    out.insert(out.end(), bytes, bytes + sizeof(bytes));
+}
 
-    try {
-        auto *ptr = handleFromId(handle);
-        if (!ptr || !ptr->dir) {
-            return nullptr;
-        }
+static void appendUint32(std::vector<uint8_t> &out, uint32_t value, Common::Endianness endianness) {
+    uint8_t bytes[4];
+    Common::WriteStream stream(bytes, sizeof(bytes), endianness);
+    stream.writeUint32(value);
+    out.insert(out.end(), bytes, bytes + sizeof(bytes));
+}
 
-        Common::BufferView chunkView = ptr->dir->getChunkData(fourCC, id);
-        const size_t size = chunkView.size();
-        const size_t allocSize = size > 0 ? size : 1;
+// Where the pieces of an Afterburner input file live, for reuse when writing one back out.
+struct AfterburnerLayout {
+    Common::BufferView fver;
+    size_t ilsBodyOffset;
+};
 
-        uint8_t *out = static_cast<uint8_t *>(std::malloc(allocSize));
-        if (!out) {
-            return nullptr;
+static bool readAfterburnerLayout(const ProjectorRaysHandle &handle, AfterburnerLayout &layout) {
+    const Director::DirectorFile &dir = *handle.dir;
+    Common::ReadStream stream(handle.input.data(), handle.input.size(), dir.endianness);
+    if (stream.readUint32() != FOURCC('R', 'I', 'F', 'X')) {
+        return false;
+    }
+    stream.readUint32();
+    const uint32_t codec = stream.readUint32();
+    if (codec != FOURCC('F', 'G', 'D', 'M') && codec != FOURCC('F', 'G', 'D', 'C')) {
+        return false;
+    }
+
+    const uint32_t sections[] = {FOURCC('F', 'v', 'e', 'r'), FOURCC('F', 'c', 'd', 'r'),
+                                 FOURCC('A', 'B', 'M', 'P')};
+    for (uint32_t fourCC : sections) {
+        if (stream.readUint32() != fourCC) {
+            return false;
         }
-        if (size > 0) {
-            std::memcpy(out, chunkView.data(), size);
+        const size_t length = stream.readVarInt();
+        if (stream.pos() + length > handle.input.size()) {
+            return false;
         }
-        *outputSize = size;
-        return out;
-    } catch (...) {
-        return nullptr;
+        if (fourCC == FOURCC('F', 'v', 'e', 'r')) {
+            layout.fver = Common::BufferView(handle.input.data() + stream.pos(), length);
+        }
+        stream.seek(stream.pos() + length);
+    }
+
+    if (stream.readUint32() != FOURCC('F', 'G', 'E', 'I')) {
+        return false;
     }
+    stream.readVarInt();
+    layout.ilsBodyOffset = stream.pos();
+    return true;
 }
 
-EMSCRIPTEN_KEEPALIVE uint8_t *projectorrays_get_script(uintptr_t handle, int32_t id,
-                                                       size_t *outputSize) {
-    if (!handle || !outputSize) {
-        return nullptr;
+// The imap for an Afterburner input, which has none: version 1 layout with the map and Director
+// versions taken from the Fver section. The mmap offset is filled in by the writer.
+static bool buildInitialMap(const ProjectorRaysHandle &handle, std::vector<uint8_t> &imap) {
+    AfterburnerLayout layout;
+    if (!readAfterburnerLayout(handle, layout) || layout.fver.size() == 0) {
+        return false;
     }
 
-    *outputSize = 0;
+    Common::ReadStream fver(layout.fver.data(), layout.fver.size(), handle.dir->endianness);
+    uint32_t imapVersion = 1;
+    uint32_t directorVersion = 0;
+    if (fver.readVarInt() >= 0x401) {
+        imapVersion = fver.readVarInt();
+        directorVersion = fver.readVarInt();
+    }
 
-    try {
-        auto *ptr = handleFromId(handle);
-        if (!ptr || !ptr->dir) {
-            return nullptr;
+    imap.clear();
+    appendUint32(imap, imapVersion, handle.dir->endianness);
+    appendUint32(imap, 0, handle.dir->endianness);
+    appendUint32(imap, directorVersion, handle.dir->endianness);
+    for (int i = 0; i < 3; ++i) {
+        appendUint32(imap, 0, handle.dir->endianness);
+    }
+    return true;
+}
+
+// The codec and imap for writeIncrementalToBuffer's output. Plain RIFX input keeps its imap apart
+// from the mmap offset. Afterburner input has none, so one is built and the output is labelled as
+// the matching uncompressed movie or cast.
+static bool readIncrementalHeader(const ProjectorRaysHandle &handle, uint32_t &codec,
+                                  std::vector<uint8_t> &imapData) {
+    Director::DirectorFile &dir = *handle.dir;
+    if (handle.input.size() < 12) {
+        return false;
+    }
+
+    Common::ReadStream header(handle.input.data(), handle.input.size(), dir.endianness);
+    const uint32_t containerFourCC = header.readUint32();
+    header.readUint32();
+    codec = header.readUint32();
+    if (containerFourCC != FOURCC('R', 'I', 'F', 'X')) {
+        return false;
+    }
+
+    if (codec == FOURCC('F', 'G', 'D', 'M') || codec == FOURCC('F', 'G', 'D', 'C')) {
+        if (!buildInitialMap(handle, imapData)) {
+            return false;
         }
+        codec = codec == FOURCC('F', 'G', 'D', 'C') ? FOURCC('M', 'C', '9', '5')
+                                                     : FOURCC('M', 'V', '9', '3');
+    } else if (dir.chunkExists(FOURCC('i', 'm', 'a', 'p'), 1)) {
+        const Common::BufferView imapView = dir.getChunkData(FOURCC('i', 'm', 'a', 'p'), 1);
+        imapData.assign(imapView.data(), imapView.data() + imapView.size());
+    } else {
+        return false;
+    }
+    return imapData.size() >= 8;
+}
 
-        ptr->dir->config->unprotect();
-        ptr->dir->parseScripts();
+// Lay out an uncompressed RIFX movie from a finished write plan and the header read by
+// readIncrementalHeader, without going through DirectorFile::write: only the imap and mmap are
+// produced here. The returned buffer is allocated with malloc so that it can be handed to the
+// caller as-is.
+static uint8_t *layoutIncrementalWrite(ProjectorRaysHandle &handle, const WritePlan &plan,
+                                       uint32_t codec, const std::vector<uint8_t> &imapData,
+                                       size_t *outputSize) {
+    Director::DirectorFile &dir = *handle.dir;
+    const std::vector<WriteChunk> &chunks = plan.chunks;
+
+    int32_t maxId = 2;
+    for (const auto &chunk : chunks) {
+        maxId = std::max(maxId, chunk.id);
+    }
 
-        for (const auto &cast : ptr->dir->casts) {
-            if (!cast->lctx) {
-                continue;
-            }
-            auto it = cast->lctx->scripts.find(id);
-            if (it == cast->lctx->scripts.end()) {
-                continue;
-            }
+    auto chunkSpan = [](size_t len) { return 8 + len + (len % 2); };
 
-            auto script = it->second;
-            auto scriptChunk = static_cast<Director::ScriptChunk *>(script);
-            Director::CastMemberChunk *member = scriptChunk->member;
-            if (!member) {
-                continue;
-            }
+    const size_t imapOffset = 12;
+    const size_t mmapOffset = imapOffset + chunkSpan(imapData.size());
+    const size_t mmapEntryCount = static_cast<size_t>(maxId) + 1;
+    const size_t mmapLen = 24 + 20 * mmapEntryCount;
 
-            std::string scriptType;
-            if (member->type == Director::kScriptMember) {
-                auto scriptMember = static_cast<Director::ScriptMember *>(member->member.get());
-                switch (scriptMember->scriptType) {
-                case Director::kScoreScript:
-                    scriptType = (ptr->dir->version >= 600) ? "BehaviorScript" : "ScoreScript";
-                    break;
-                case Director::kMovieScript:
-                    scriptType = "MovieScript";
-                    break;
-                case Director::kParentScript:
-                    scriptType = "ParentScript";
-                    break;
-                default:
-                    scriptType = "UnknownScript";
-                    break;
-                }
-            } else {
-                scriptType = "CastScript";
-            }
+    size_t totalSize = mmapOffset + chunkSpan(mmapLen);
+    std::vector<size_t> chunkOffsets;
+    chunkOffsets.reserve(chunks.size());
+    for (const auto &chunk : chunks) {
+        chunkOffsets.push_back(totalSize);
+        totalSize += chunkSpan(chunk.data.size());
+    }
 
-            Common::JSONWriter json("\n");
-            json.startObject();
-            json.writeField("scriptId", static_cast<int>(id));
-            json.writeField("memberId", static_cast<int>(member->id));
-            json.writeField("memberName", member->getName());
-            json.writeField("scriptType", scriptType);
-            json.writeField("castName", cast->name);
-            json.writeKey("lingo");
-            json.writeVal(script->scriptText("\n", ptr->dir->dotSyntax));
-            json.writeKey("bytecode");
-            json.writeVal(script->bytecodeText("\n", ptr->dir->dotSyntax));
-            json.endObject();
+    struct MapEntry {
+        uint32_t fourCC;
+        uint32_t len;
+        uint32_t offset;
+        int16_t flags;
+    };
+    std::vector<MapEntry> mapEntries(mmapEntryCount, {FOURCC('f', 'r', 'e', 'e'), 0, 0, 12});
+    mapEntries[0] = {FOURCC('R', 'I', 'F', 'X'), static_cast<uint32_t>(totalSize - 8), 0, 0};
+    mapEntries[1] = {FOURCC('i', 'm', 'a', 'p'), static_cast<uint32_t>(imapData.size()),
+                     static_cast<uint32_t>(imapOffset), 0};
+    mapEntries[2] = {FOURCC('m', 'm', 'a', 'p'), static_cast<uint32_t>(mmapLen),
+                     static_cast<uint32_t>(mmapOffset), 0};
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        mapEntries[chunks[i].id] = {chunks[i].fourCC, static_cast<uint32_t>(chunks[i].data.size()),
+                                    static_cast<uint32_t>(chunkOffsets[i]), 0};
+    }
 
-            std::string outputStr = standardizeJsonEscapes(json.str());
-            if (outputStr.empty()) {
-                return nullptr;
-            }
+    uint8_t *out = static_cast<uint8_t *>(std::malloc(totalSize));
+    if (!out) {
+        return nullptr;
+    }
 
-            uint8_t *out = static_cast<uint8_t *>(std::malloc(outputStr.size()));
-            if (!out) {
-                return nullptr;
+    try {
+        Common::WriteStream stream(out, totalSize, dir.endianness);
+        auto writePadding = [&stream](size_t len) {
+            if (len % 2) {
+                stream.writeUint8(0);
             }
-            std::memcpy(out, outputStr.data(), outputStr.size());
-            *outputSize = outputStr.size();
-            return out;
+        };
+
+        stream.writeUint32(FOURCC('R', 'I', 'F', 'X'));
+        stream.writeUint32(static_cast<uint32_t>(totalSize - 8));
+        stream.writeUint32(codec);
+
+        // The imap is written verbatim apart from the mmap offset.
+        stream.writeUint32(FOURCC('i', 'm', 'a', 'p'));
+        stream.writeUint32(static_cast<uint32_t>(imapData.size()));
+        stream.writeBytes(imapData.data(), 4);
+        stream.writeUint32(static_cast<uint32_t>(mmapOffset));
+        stream.writeBytes(imapData.data() + 8, imapData.size() - 8);
+        writePadding(imapData.size());
+
+        stream.writeUint32(FOURCC('m', 'm', 'a', 'p'));
+        stream.writeUint32(static_cast<uint32_t>(mmapLen));
+        stream.writeInt16(24);
+        stream.writeInt16(20);
+        stream.writeInt32(static_cast<int32_t>(mmapEntryCount));
+        stream.writeInt32(static_cast<int32_t>(mmapEntryCount));
+        stream.writeInt32(-1);
+        stream.writeInt32(-1);
+        stream.writeInt32(-1);
+        for (const auto &entry : mapEntries) {
+            stream.writeUint32(entry.fourCC);
+            stream.writeUint32(entry.len);
+            stream.writeUint32(entry.offset);
+            stream.writeInt16(entry.flags);
+            stream.writeInt16(0);
+            stream.writeInt32(0);
         }
+        writePadding(mmapLen);
 
-        return nullptr;
+        for (const auto &chunk : chunks) {
+            stream.writeUint32(chunk.fourCC);
+            stream.writeUint32(static_cast<uint32_t>(chunk.data.size()));
+            if (chunk.data.size() > 0) {
+                stream.writeBytes(chunk.data.data(), chunk.data.size());
+            }
+            writePadding(chunk.data.size());
+        }
     } catch (...) {
+        std::free(out);
         return nullptr;
     }
+
+    *outputSize = totalSize;
+    return out;
 }
 
-EMSCRIPTEN_KEEPALIVE uint8_t *projectorrays_implemented_dump_json(uintptr_t handle,
-                                                                  size_t *outputSize) {
-    if (!handle || !outputSize) {
+// Write an uncompressed RIFX movie, copying the chunks that were not touched straight out of the
+// input buffer (decompressed, for Afterburner input) and re-serializing only the ones named by
+// `flags`.
+static uint8_t *writeIncrementalToBuffer(ProjectorRaysHandle &handle, uint32_t flags,
+                                         size_t *outputSize) {
+    uint32_t codec = 0;
+    std::vector<uint8_t> imapData;
+    if (!readIncrementalHeader(handle, codec, imapData)) {
+        return nullptr;
+    }
+    WritePlan plan;
+    beginWrite(handle, flags, plan);
+    if (!loadWritePlan(handle, plan)) {
         return nullptr;
     }
+    return layoutIncrementalWrite(handle, plan, codec, imapData, outputSize);
+}
 
-    *outputSize = 0;
+static bool deflateBytes(const uint8_t *data, size_t size, int level,
+                         std::vector<uint8_t> &output) {
+    static const uint8_t empty = 0;
+    uLongf outputLen = compressBound(size);
+    output.resize(outputLen);
+    if (compress2(output.data(), &outputLen, data ? data : &empty, size, level) != Z_OK) {
+        output.clear();
+        return false;
+    }
+    output.resize(outputLen);
+    return true;
+}
 
-    try {
-        auto *ptr = handleFromId(handle);
-        if (!ptr || !ptr->dir) {
-            return nullptr;
+// How many threads runParallel uses for `threadCount` (0 = one per core): 1 without thread
+// support (a WASM build without pthreads).
+static unsigned parallelThreadCount(unsigned threadCount) {
+#if !defined(__EMSCRIPTEN__) || defined(__EMSCRIPTEN_PTHREADS__)
+    if (threadCount == 0) {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+#ifdef PROJECTORRAYS_THREAD_POOL_SIZE
+    // Spawning past the pre-started worker pool would block the browser main thread.
+    threadCount = std::min(threadCount, static_cast<unsigned>(PROJECTORRAYS_THREAD_POOL_SIZE) + 1);
+#endif
+    return threadCount;
+#else
+    (void)threadCount;
+    return 1;
+#endif
+}
+
+// Run `job(i)` for every i < jobCount on up to `threadCount` threads (0 = one per core). Without
+// thread support the jobs simply run in order.
+static void runParallel(size_t jobCount, unsigned threadCount,
+                        const std::function<void(size_t)> &job) {
+#if !defined(__EMSCRIPTEN__) || defined(__EMSCRIPTEN_PTHREADS__)
+    threadCount =
+        static_cast<unsigned>(std::min<size_t>(parallelThreadCount(threadCount), jobCount));
+    if (threadCount > 1) {
+        std::atomic<size_t> next(0);
+        auto worker = [&]() {
+            for (size_t i = next++; i < jobCount; i = next++) {
+                job(i);
+            }
+        };
+        std::vector<std::thread> threads;
+        for (unsigned i = 1; i < threadCount; ++i) {
+            threads.emplace_back(worker);
         }
+        worker();
+        for (auto &thread : threads) {
+            thread.join();
+        }
+        return;
+    }
+#else
+    (void)threadCount;
+#endif
+    for (size_t i = 0; i < jobCount; ++i) {
+        job(i);
+    }
+}
 
-        std::string output = "[";
-        bool first = true;
+// Afterburner chunks that never live in the initial load segment unless the input put them there.
+static bool isStreamedMedia(uint32_t fourCC) {
+    switch (fourCC) {
+    case FOURCC('B', 'I', 'T', 'D'):
+    case FOURCC('A', 'L', 'F', 'A'):
+    case FOURCC('T', 'h', 'u', 'm'):
+    case FOURCC('s', 'n', 'd', ' '):
+    case FOURCC('s', 'n', 'd', 'H'):
+    case FOURCC('s', 'n', 'd', 'S'):
+    case FOURCC('e', 'd', 'i', 'M'):
+    case FOURCC('X', 'M', 'E', 'D'):
+    case FOURCC('m', 'e', 'd', 'i'):
+        return true;
+    default:
+        return false;
+    }
+}
 
-        for (const auto &entry : ptr->dir->chunkInfo) {
-            const auto &info = entry.second;
-            if (info.id == 0) {
-                continue;
-            }
+struct OutputResource {
+    const WriteChunk *chunk;
+    Common::BufferView stored;
+    std::vector<uint8_t> compressed;
+    uint32_t compressionType;
+    // Whether the input's compressed bytes are copied over instead of deflating `chunk->data`.
+    bool reuse;
+    bool failed;
+};
 
-            try {
-                auto chunk = ptr->dir->getChunk(info.fourCC, info.id);
-                if (!chunk) {
-                    continue;
-                }
+// An Afterburner write split into streams that can be deflated independently: stream 0 is the
+// ILS (the initial load segment, holding every chunk that isn't a resource of its own) and
+// stream i is resources[i - 1].
+struct AfterburnerWrite {
+    AfterburnerLayout source;
+    bool sourceAfterburned = false;
+    int level = Z_DEFAULT_COMPRESSION;
+    std::vector<Director::MoaID> compressionIDs;
+    std::vector<const WriteChunk *> ilsChunks;
+    std::vector<OutputResource> resources;
+    std::vector<uint8_t> ils;
+    std::vector<uint8_t> ilsCompressed;
+    bool ilsFailed = false;
+
+    size_t streamCount() const { return resources.size() + 1; }
+};
 
-                Common::JSONWriter json("\n");
-                chunk->writeJSON(json);
-                std::string chunkJson = standardizeJsonEscapes(json.str());
-                if (chunkJson.empty()) {
-                    continue;
-                }
+static const uint32_t kZlibCompressionIndex = 0;
+static const uint32_t kNullCompressionIndex = 1;
+
+// Decide which chunks become resources of their own and which of those keep the input's
+// compressed bytes. Runs right after beginWrite, as it only needs the chunk list, and takes the
+// reused chunks out of `plan.loads` so they are never decompressed.
+static void planAfterburnedWrite(ProjectorRaysHandle &handle, uint32_t flags, int level,
+                                 WritePlan &plan, AfterburnerWrite &write) {
+    Director::DirectorFile &dir = *handle.dir;
+    write.level = std::min(std::max(level, static_cast<int>(Z_DEFAULT_COMPRESSION)),
+                           static_cast<int>(Z_BEST_COMPRESSION));
+    write.sourceAfterburned = readAfterburnerLayout(handle, write.source);
+    write.compressionIDs = {Director::ZLIB_COMPRESSION_GUID, Director::NULL_COMPRESSION_GUID};
+    auto compressionIndex = [&write](const Director::MoaID &id) {
+        for (size_t i = 0; i < write.compressionIDs.size(); ++i) {
+            if (write.compressionIDs[i] == id) {
+                return static_cast<uint32_t>(i);
+            }
+        }
+        write.compressionIDs.push_back(id);
+        return static_cast<uint32_t>(write.compressionIDs.size() - 1);
+    };
+
+    const auto ilsInfo = dir.chunkInfo.find(2);
+    std::vector<size_t> loads;
+    for (size_t index : plan.loads) {
+        const WriteChunk &chunk = plan.chunks[index];
+        auto info = dir.chunkInfo.find(chunk.id);
+        bool standalone = isStreamedMedia(chunk.fourCC);
+        bool reuse = false;
+        if (write.sourceAfterburned && info != dir.chunkInfo.end() &&
+            ilsInfo != dir.chunkInfo.end()) {
+            // Chunks stored after the ILS body were separate streams in the input.
+            const int64_t offset = info->second.offset;
+            standalone = offset >= static_cast<int64_t>(ilsInfo->second.len) &&
+                         write.source.ilsBodyOffset + offset + info->second.len <=
+                             handle.input.size();
+            const bool plainCompression =
+                info->second.compressionID == Director::ZLIB_COMPRESSION_GUID ||
+                info->second.compressionID == Director::NULL_COMPRESSION_GUID;
+            reuse = standalone && !chunk.modified &&
+                    ((flags & kWriteKeepCompressed) || !plainCompression);
+        }
+
+        if (!reuse) {
+            loads.push_back(index);
+        }
+        if (!standalone) {
+            write.ilsChunks.push_back(&chunk);
+            continue;
+        }
+
+        OutputResource resource;
+        resource.chunk = &chunk;
+        resource.reuse = reuse;
+        resource.failed = false;
+        if (reuse) {
+            resource.stored = Common::BufferView(
+                handle.input.data() + write.source.ilsBodyOffset + info->second.offset,
+                info->second.len);
+            resource.compressionType = compressionIndex(info->second.compressionID);
+        } else {
+            resource.compressionType = kZlibCompressionIndex;
+        }
+        write.resources.push_back(std::move(resource));
+    }
+    plan.loads.swap(loads);
+}
+
+// Compress stream `index` once the plan's chunk data is loaded. Each stream only touches its own
+// buffers, so different streams can be deflated on different threads.
+static void deflateAfterburnedStream(AfterburnerWrite &write, size_t index) {
+    if (index == 0) {
+        for (const WriteChunk *chunk : write.ilsChunks) {
+            appendVarInt(write.ils, static_cast<uint32_t>(chunk->id));
+            write.ils.insert(write.ils.end(), chunk->data.data(),
+                             chunk->data.data() + chunk->data.size());
+        }
+        write.ilsFailed =
+            !deflateBytes(write.ils.data(), write.ils.size(), write.level, write.ilsCompressed);
+        return;
+    }
+
+    OutputResource &resource = write.resources[index - 1];
+    if (resource.reuse) {
+        return;
+    }
+    const Common::BufferView &raw = resource.chunk->data;
+    if (!deflateBytes(raw.data(), raw.size(), write.level, resource.compressed)) {
+        resource.failed = true;
+        return;
+    }
+    // Already-compressed media often grows under deflate; store it as-is instead.
+    if (resource.compressed.size() >= raw.size()) {
+        resource.compressed.clear();
+        resource.stored = raw;
+        resource.compressionType = kNullCompressionIndex;
+    } else {
+        resource.stored =
+            Common::BufferView(resource.compressed.data(), resource.compressed.size());
+    }
+}
+
+// Lay out a compressed Afterburner (FGDM/FGDC) movie from deflated streams. The Fver, Fcdr, ABMP
+// and FGEI sections are generated here.
+static uint8_t *layoutAfterburnedWrite(ProjectorRaysHandle &handle, const AfterburnerWrite &write,
+                                       size_t *outputSize) {
+    Director::DirectorFile &dir = *handle.dir;
+    if (write.ilsFailed) {
+        return nullptr;
+    }
+    for (const auto &resource : write.resources) {
+        if (resource.failed) {
+            return nullptr;
+        }
+    }
+
+    const Common::Endianness endianness = dir.endianness;
+    const int level = write.level;
+
+    std::vector<uint8_t> fver;
+    if (write.sourceAfterburned) {
+        fver.assign(write.source.fver.data(), write.source.fver.data() + write.source.fver.size());
+    } else {
+        uint32_t imapVersion = 1;
+        uint32_t directorVersion = 0;
+        if (dir.chunkExists(FOURCC('i', 'm', 'a', 'p'), 1)) {
+            Common::BufferView imapData = dir.getChunkData(FOURCC('i', 'm', 'a', 'p'), 1);
+            if (imapData.size() >= 12) {
+                Common::ReadStream imap(imapData.data(), imapData.size(), endianness);
+                imapVersion = imap.readUint32();
+                imap.readUint32();
+                directorVersion = imap.readUint32();
+            }
+        }
+        appendVarInt(fver, 0x401);
+        appendVarInt(fver, imapVersion);
+        appendVarInt(fver, directorVersion);
+    }
+
+    std::vector<uint8_t> fcdrRaw;
+    appendUint16(fcdrRaw, static_cast<uint16_t>(write.compressionIDs.size()), endianness);
+    for (const auto &id : write.compressionIDs) {
+        appendUint32(fcdrRaw, id.data1, endianness);
+        appendUint16(fcdrRaw, id.data2, endianness);
+        appendUint16(fcdrRaw, id.data3, endianness);
+        fcdrRaw.insert(fcdrRaw.end(), id.data4, id.data4 + 8);
+    }
+    for (const auto &id : write.compressionIDs) {
+        std::string description;
+        if (id == Director::ZLIB_COMPRESSION_GUID) {
+            description = "zlib";
+        } else if (id == Director::NULL_COMPRESSION_GUID) {
+            description = "none";
+        }
+        fcdrRaw.insert(fcdrRaw.end(), description.begin(), description.end());
+        fcdrRaw.push_back(0);
+    }
+    std::vector<uint8_t> fcdr;
+    if (!deflateBytes(fcdrRaw.data(), fcdrRaw.size(), level, fcdr)) {
+        return nullptr;
+    }
+
+    // ABMP offsets are relative to the start of the ILS body; chunks inside the ILS have none.
+    std::vector<uint8_t> abmpRaw;
+    appendVarInt(abmpRaw, 0);
+    appendVarInt(abmpRaw, 0);
+    appendVarInt(abmpRaw,
+                 static_cast<uint32_t>(1 + write.ilsChunks.size() + write.resources.size()));
+    auto appendMapEntry = [&](int32_t id, int32_t offset, size_t compressedLen,
+                              size_t uncompressedLen, uint32_t compressionType, uint32_t fourCC) {
+        appendVarInt(abmpRaw, static_cast<uint32_t>(id));
+        appendVarInt(abmpRaw, static_cast<uint32_t>(offset));
+        appendVarInt(abmpRaw, static_cast<uint32_t>(compressedLen));
+        appendVarInt(abmpRaw, static_cast<uint32_t>(uncompressedLen));
+        appendVarInt(abmpRaw, compressionType);
+        appendUint32(abmpRaw, fourCC, endianness);
+    };
+    appendMapEntry(2, 0, write.ilsCompressed.size(), write.ils.size(), kZlibCompressionIndex,
+                   FOURCC('I', 'L', 'S', ' '));
+    for (const WriteChunk *chunk : write.ilsChunks) {
+        appendMapEntry(chunk->id, -1, chunk->data.size(), chunk->data.size(),
+                       kNullCompressionIndex, chunk->fourCC);
+    }
+    size_t resourceOffset = write.ilsCompressed.size();
+    for (const auto &resource : write.resources) {
+        size_t uncompressedLen = resource.chunk->data.size();
+        if (resource.reuse) {
+            uncompressedLen = dir.chunkInfo.at(resource.chunk->id).uncompressedLen;
+        }
+        appendMapEntry(resource.chunk->id, static_cast<int32_t>(resourceOffset),
+                       resource.stored.size(), uncompressedLen, resource.compressionType,
+                       resource.chunk->fourCC);
+        resourceOffset += resource.stored.size();
+    }
+    std::vector<uint8_t> abmpCompressed;
+    if (!deflateBytes(abmpRaw.data(), abmpRaw.size(), level, abmpCompressed)) {
+        return nullptr;
+    }
+    std::vector<uint8_t> abmp;
+    appendVarInt(abmp, kZlibCompressionIndex);
+    appendVarInt(abmp, static_cast<uint32_t>(abmpRaw.size()));
+    abmp.insert(abmp.end(), abmpCompressed.begin(), abmpCompressed.end());
+
+    std::vector<uint8_t> head;
+    auto appendSection = [&head, endianness](uint32_t fourCC, const std::vector<uint8_t> &body) {
+        appendUint32(head, fourCC, endianness);
+        appendVarInt(head, static_cast<uint32_t>(body.size()));
+        head.insert(head.end(), body.begin(), body.end());
+    };
+    appendSection(FOURCC('F', 'v', 'e', 'r'), fver);
+    appendSection(FOURCC('F', 'c', 'd', 'r'), fcdr);
+    appendSection(FOURCC('A', 'B', 'M', 'P'), abmp);
+    appendUint32(head, FOURCC('F', 'G', 'E', 'I'), endianness);
+    appendVarInt(head, 0);
+
+    const size_t totalSize = 12 + head.size() + resourceOffset;
+    uint8_t *out = static_cast<uint8_t *>(std::malloc(totalSize));
+    if (!out) {
+        return nullptr;
+    }
+
+    try {
+        Common::WriteStream stream(out, totalSize, endianness);
+        stream.writeUint32(FOURCC('R', 'I', 'F', 'X'));
+        stream.writeUint32(static_cast<uint32_t>(totalSize - 8));
+        stream.writeUint32(dir.isCast() ? FOURCC('F', 'G', 'D', 'C') : FOURCC('F', 'G', 'D', 'M'));
+        stream.writeBytes(head.data(), head.size());
+        stream.writeBytes(write.ilsCompressed.data(), write.ilsCompressed.size());
+        for (const auto &resource : write.resources) {
+            if (resource.stored.size() > 0) {
+                stream.writeBytes(resource.stored.data(), resource.stored.size());
+            }
+        }
+    } catch (...) {
+        std::free(out);
+        return nullptr;
+    }
+
+    *outputSize = totalSize;
+    return out;
+}
+
+// Write a compressed Afterburner movie. Every chunk outside the initial load segment becomes its
+// own zlib stream, and those streams are deflated in parallel. With kWriteKeepCompressed,
+// unmodified chunks of an Afterburner input are copied over in their original compressed form
+// without being decompressed first.
+static uint8_t *writeAfterburnedToBuffer(ProjectorRaysHandle &handle, uint32_t flags, int level,
+                                         unsigned threadCount, size_t *outputSize) {
+    WritePlan plan;
+    AfterburnerWrite write;
+    beginWrite(handle, flags, plan);
+    planAfterburnedWrite(handle, flags, level, plan, write);
+    if (!loadWritePlan(handle, plan)) {
+        return nullptr;
+    }
+    runParallel(write.streamCount(), threadCount,
+                [&write](size_t i) { deflateAfterburnedStream(write, i); });
+    return layoutAfterburnedWrite(handle, write, outputSize);
+}
+
+// Catalog columns, one entry per cast member. See projectorrays_cast_catalog for the layout.
+struct CastCatalog {
+    std::vector<int32_t> memberId;
+    std::vector<int32_t> castIndex;
+    std::vector<uint8_t> type;
+    std::vector<uint8_t> scriptType;
+    std::vector<int32_t> width;
+    std::vector<int32_t> height;
+    std::vector<uint8_t> depth;
+    std::vector<uint32_t> soundMedia;
+    std::vector<uint32_t> soundFormat;
+    std::vector<int32_t> sampleRate;
+    std::vector<uint8_t> sampleSize;
+    std::vector<uint8_t> channelCount;
+    std::vector<int32_t> nameOffsets;
+    std::vector<int32_t> castNameOffsets;
+    std::string strings;
+};
+
+static void appendPadding(std::vector<uint8_t> &out) {
+    while (out.size() % 4) {
+        out.push_back(0);
+    }
+}
+
+static void appendInt32Column(std::vector<uint8_t> &out, const std::vector<int32_t> &column) {
+    for (int32_t value : column) {
+        appendUint32(out, static_cast<uint32_t>(value), Common::kLittleEndian);
+    }
+}
+
+static void appendUint32Column(std::vector<uint8_t> &out, const std::vector<uint32_t> &column) {
+    for (uint32_t value : column) {
+        appendUint32(out, value, Common::kLittleEndian);
+    }
+}
+
+static void appendUint8Column(std::vector<uint8_t> &out, const std::vector<uint8_t> &column) {
+    out.insert(out.end(), column.begin(), column.end());
+    appendPadding(out);
+}
+
+// Size and depth from a bitmap member's specific data (D4+ layout, always big-endian).
+static void readBitmapInfo(const Director::CastMemberChunk &member, int32_t &width,
+                           int32_t &height, uint8_t &depth) {
+    const Common::BufferView &data = member.specificData;
+    if (data.size() < 22) {
+        return;
+    }
+    Common::ReadStream stream(data.data(), data.size(), Common::kBigEndian);
+    const uint16_t pitch = stream.readUint16();
+    const int16_t top = stream.readInt16();
+    const int16_t left = stream.readInt16();
+    const int16_t bottom = stream.readInt16();
+    const int16_t right = stream.readInt16();
+    width = right - left;
+    height = bottom - top;
+
+    // Bounding rect and registration point, then the depth when the pitch is flagged.
+    stream.seek(stream.pos() + 12);
+    depth = 1;
+    if ((pitch & 0x8000) && data.size() >= stream.pos() + 2) {
+        stream.readUint8();
+        depth = stream.readUint8();
+    }
+}
+
+// Sample format from a Mac 'snd ' resource: rate, sample size and channel count from the sound
+// header the first bufferCmd/soundCmd points to. Also used for the sndH chunk of a sndS member,
+// which holds the same resource header with the samples moved out into the sndS chunk. Anything
+// that doesn't parse as one leaves the outputs untouched.
+static void readSoundInfo(const Common::BufferView &data, uint32_t &format, int32_t &sampleRate,
+                          uint8_t &sampleSize, uint8_t &channelCount) {
+    Common::ReadStream stream(data.data(), data.size(), Common::kBigEndian);
+    const uint16_t resourceFormat = stream.readUint16();
+    if (resourceFormat == 1) {
+        const uint16_t dataFormatCount = stream.readUint16();
+        stream.seek(stream.pos() + 6 * dataFormatCount);
+    } else if (resourceFormat == 2) {
+        stream.readUint16();
+    } else {
+        return;
+    }
+
+    const uint16_t commandCount = stream.readUint16();
+    uint32_t headerOffset = 0;
+    for (uint16_t i = 0; i < commandCount; ++i) {
+        const uint16_t command = stream.readUint16() & 0x7fff;
+        stream.readUint16();
+        const uint32_t param2 = stream.readUint32();
+        if ((command == 0x50 || command == 0x51) && headerOffset == 0) {
+            headerOffset = param2;
+        }
+    }
+    if (headerOffset == 0 || headerOffset + 22 > data.size()) {
+        return;
+    }
+
+    stream.seek(headerOffset);
+    stream.readUint32();
+    const uint32_t lengthOrChannels = stream.readUint32();
+    sampleRate = static_cast<int32_t>(stream.readUint32() >> 16);
+    stream.readUint32();
+    stream.readUint32();
+    const uint8_t encoding = stream.readUint8();
+    stream.readUint8();
+
+    if (encoding == 0x00) {
+        // Standard header: 8-bit mono, offset binary.
+        format = FOURCC('r', 'a', 'w', ' ');
+        sampleSize = 8;
+        channelCount = 1;
+    } else if (encoding == 0xff || encoding == 0xfe) {
+        // Extended (0xff) or compressed (0xfe) header. Both continue with the frame count and
+        // the AIFF rate; the sample size follows the marker/instrument/AES pointers in the
+        // former and the codec fields in the latter.
+        const size_t extraOffset = stream.pos();
+        channelCount = static_cast<uint8_t>(lengthOrChannels);
+        const size_t sampleSizeOffset = extraOffset + ((encoding == 0xff) ? 26 : 40);
+        if (sampleSizeOffset + 2 <= data.size()) {
+            stream.seek(sampleSizeOffset);
+            sampleSize = static_cast<uint8_t>(stream.readUint16());
+        }
+
+        if (encoding == 0xff) {
+            // Uncompressed: 8-bit samples are offset binary, wider ones two's complement.
+            format = sampleSize > 8 ? FOURCC('t', 'w', 'o', 's') : FOURCC('r', 'a', 'w', ' ');
+        } else if (extraOffset + 36 <= data.size()) {
+            // The codec's OSType (MAC3, ima4, ...). Older files leave it 0 and only set
+            // compressionID, where 3 and 4 are the MACE codecs.
+            stream.seek(extraOffset + 18);
+            format = stream.readUint32();
+            stream.seek(extraOffset + 34);
+            const int16_t compressionID = stream.readInt16();
+            if (format == 0 && compressionID == 3) {
+                format = FOURCC('M', 'A', 'C', '3');
+            } else if (format == 0 && compressionID == 4) {
+                format = FOURCC('M', 'A', 'C', '6');
+            }
+        }
+    }
+}
+
+// Parse the handle's input. On failure `dir` is left empty, so every other entry point treats the
+// handle as unreadable.
+static bool readHandleInput(ProjectorRaysHandle &handle) {
+    handle.stream = std::make_unique<Common::ReadStream>(handle.input.data(), handle.input.size());
+    handle.dir = std::make_unique<Director::DirectorFile>();
+    if (!handle.dir->read(handle.stream.get())) {
+        handle.dir.reset();
+        return false;
+    }
+    return true;
+}
+
+EMSCRIPTEN_KEEPALIVE uintptr_t projectorrays_read(const uint8_t *input, size_t inputSize) {
+    if (!input || inputSize == 0) {
+        return 0;
+    }
+
+    try {
+        auto handle = std::make_unique<ProjectorRaysHandle>();
+        handle->input.assign(input, input + inputSize);
+        if (!readHandleInput(*handle)) {
+            return 0;
+        }
+        return reinterpret_cast<uintptr_t>(handle.release());
+    } catch (...) {
+        return 0;
+    }
+}
+
+// A handle whose input buffer of `inputSize` bytes the caller fills in before calling
+// projectorrays_read_input, instead of passing a buffer for projectorrays_read to copy.
+EMSCRIPTEN_KEEPALIVE uint8_t *projectorrays_alloc_input(size_t inputSize, uintptr_t *handle) {
+    if (!handle) {
+        return nullptr;
+    }
+    *handle = 0;
+    if (inputSize == 0) {
+        return nullptr;
+    }
+
+    try {
+        auto ptr = std::make_unique<ProjectorRaysHandle>();
+        ptr->input.resize(inputSize);
+        uint8_t *input = ptr->input.data();
+        *handle = reinterpret_cast<uintptr_t>(ptr.release());
+        return input;
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+EMSCRIPTEN_KEEPALIVE int projectorrays_read_input(uintptr_t handle) {
+    if (!handle) {
+        return 0;
+    }
+
+    try {
+        auto *ptr = handleFromId(handle);
+        if (!ptr || ptr->dir) {
+            return 0;
+        }
+        return readHandleInput(*ptr) ? 1 : 0;
+    } catch (...) {
+        return 0;
+    }
+}
+
+EMSCRIPTEN_KEEPALIVE void projectorrays_free_handle(uintptr_t handle) {
+    auto *ptr = handleFromId(handle);
+    delete ptr;
+}
+
+EMSCRIPTEN_KEEPALIVE int projectorrays_chunk_exists(uintptr_t handle, uint32_t fourCC, int32_t id) {
+    if (!handle) {
+        return 0;
+    }
+
+    try {
+        auto *ptr = handleFromId(handle);
+        if (!ptr || !ptr->dir) {
+            return 0;
+        }
+        Common::BufferView view;
+        return findChunkView(*ptr, fourCC, id, view) ? 1 : 0;
+    } catch (...) {
+        return 0;
+    }
+}
+
+EMSCRIPTEN_KEEPALIVE int projectorrays_is_cast(uintptr_t handle) {
+    if (!handle) {
+        return 0;
+    }
+
+    try {
+        auto *ptr = handleFromId(handle);
+        if (!ptr || !ptr->dir) {
+            return 0;
+        }
+        return ptr->dir->isCast() ? 1 : 0;
+    } catch (...) {
+        return 0;
+    }
+}
+
+EMSCRIPTEN_KEEPALIVE int projectorrays_size(uintptr_t handle) {
+    if (!handle) {
+        return 0;
+    }
+
+    try {
+        auto *ptr = handleFromId(handle);
+        if (!ptr || !ptr->dir) {
+            return 0;
+        }
+        return static_cast<int>(ptr->dir->size());
+    } catch (...) {
+        return 0;
+    }
+}
+
+EMSCRIPTEN_KEEPALIVE uint8_t *projectorrays_get_chunk(uintptr_t handle, uint32_t fourCC, int32_t id,
+                                                      size_t *outputSize) {
+    if (!handle || !outputSize) {
+        return nullptr;
+    }
+
+    *outputSize = 0;
+
+    try {
+        auto *ptr = handleFromId(handle);
+        if (!ptr || !ptr->dir) {
+            return nullptr;
+        }
+
+        Common::BufferView chunkView;
+        if (!findChunkView(*ptr, fourCC, id, chunkView)) {
+            return nullptr;
+        }
+        const size_t size = chunkView.size();
+        const size_t allocSize = size > 0 ? size : 1;
+
+        uint8_t *out = static_cast<uint8_t *>(std::malloc(allocSize));
+        if (!out) {
+            return nullptr;
+        }
+        if (size > 0) {
+            std::memcpy(out, chunkView.data(), size);
+        }
+        *outputSize = size;
+        return out;
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+EMSCRIPTEN_KEEPALIVE uint8_t *projectorrays_get_script(uintptr_t handle, int32_t id,
+                                                       size_t *outputSize) {
+    if (!handle || !outputSize) {
+        return nullptr;
+    }
+
+    *outputSize = 0;
+
+    try {
+        auto *ptr = handleFromId(handle);
+        if (!ptr || !ptr->dir) {
+            return nullptr;
+        }
+
+        ptr->dir->config->unprotect();
+        ptr->dir->parseScripts();
+
+        for (const auto &cast : ptr->dir->casts) {
+            if (!cast->lctx) {
+                continue;
+            }
+            auto it = cast->lctx->scripts.find(id);
+            if (it == cast->lctx->scripts.end()) {
+                continue;
+            }
+
+            auto script = it->second;
+            auto scriptChunk = static_cast<Director::ScriptChunk *>(script);
+            Director::CastMemberChunk *member = scriptChunk->member;
+            if (!member) {
+                continue;
+            }
+
+            std::string scriptType = scriptTypeName(*ptr->dir, member);
+
+            Common::JSONWriter json("\n");
+            json.startObject();
+            json.writeField("scriptId", static_cast<int>(id));
+            json.writeField("memberId", static_cast<int>(member->id));
+            json.writeField("memberName", member->getName());
+            json.writeField("scriptType", scriptType);
+            json.writeField("castName", cast->name);
+            json.writeKey("lingo");
+            json.writeVal(script->scriptText("\n", ptr->dir->dotSyntax));
+            json.writeKey("bytecode");
+            json.writeVal(script->bytecodeText("\n", ptr->dir->dotSyntax));
+            json.endObject();
+
+            std::string outputStr = standardizeJsonEscapes(json.str());
+            if (outputStr.empty()) {
+                return nullptr;
+            }
+
+            uint8_t *out = static_cast<uint8_t *>(std::malloc(outputStr.size()));
+            if (!out) {
+                return nullptr;
+            }
+            std::memcpy(out, outputStr.data(), outputStr.size());
+            *outputSize = outputStr.size();
+            return out;
+        }
+
+        return nullptr;
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+EMSCRIPTEN_KEEPALIVE uint8_t *projectorrays_implemented_dump_json(uintptr_t handle,
+                                                                  size_t *outputSize) {
+    if (!handle || !outputSize) {
+        return nullptr;
+    }
+
+    *outputSize = 0;
+
+    try {
+        auto *ptr = handleFromId(handle);
+        if (!ptr || !ptr->dir) {
+            return nullptr;
+        }
+
+        std::string output = "[";
+        bool first = true;
+
+        for (const auto &entry : ptr->dir->chunkInfo) {
+            const auto &info = entry.second;
+            if (info.id == 0) {
+                continue;
+            }
+
+            try {
+                auto chunk = ptr->dir->getChunk(info.fourCC, info.id);
+                if (!chunk) {
+                    continue;
+                }
+
+                Common::JSONWriter json("\n");
+                chunk->writeJSON(json);
+                std::string chunkJson = standardizeJsonEscapes(json.str());
+                if (chunkJson.empty()) {
+                    continue;
+                }
 
                 if (!first) {
                     output += ",";
@@ -386,34 +1436,93 @@ EMSCRIPTEN_KEEPALIVE uint8_t *projectorrays_implemented_dump_chunks(uintptr_t ha
             output.push_back(static_cast<uint8_t>((value >> 24) & 0xff));
         };
 
+        const auto chunkTable = effectiveChunkTable(*ptr);
+
         uint32_t count = 0;
-        for (const auto &entry : ptr->dir->chunkInfo) {
+        for (const auto &entry : chunkTable) {
             if (entry.first == 0) {
                 continue;
             }
-            ++count;
+            ++count;
+        }
+
+        appendUint32(count);
+
+        for (const auto &entry : chunkTable) {
+            const uint32_t fourCCValue = entry.second;
+            const int32_t idValue = entry.first;
+            if (idValue == 0) {
+                continue;
+            }
+            Common::BufferView chunkView;
+            findChunkView(*ptr, fourCCValue, idValue, chunkView);
+
+            appendUint32(fourCCValue);
+            appendUint32(static_cast<uint32_t>(idValue));
+            appendUint32(static_cast<uint32_t>(chunkView.size()));
+            if (chunkView.size() > 0) {
+                output.insert(output.end(), chunkView.data(), chunkView.data() + chunkView.size());
+            }
+        }
+
+        if (output.empty()) {
+            return nullptr;
+        }
+
+        uint8_t *out = static_cast<uint8_t *>(std::malloc(output.size()));
+        if (!out) {
+            return nullptr;
+        }
+        std::memcpy(out, output.data(), output.size());
+        *outputSize = output.size();
+        return out;
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+// Same layout as projectorrays_implemented_dump_chunks without the chunk data: a count followed
+// by fourCC, id and uncompressed size per chunk. Sizes come from the chunk table, so nothing is
+// decompressed.
+EMSCRIPTEN_KEEPALIVE uint8_t *projectorrays_list_chunks(uintptr_t handle, size_t *outputSize) {
+    if (!handle || !outputSize) {
+        return nullptr;
+    }
+
+    *outputSize = 0;
+
+    try {
+        auto *ptr = handleFromId(handle);
+        if (!ptr || !ptr->dir) {
+            return nullptr;
+        }
+
+        const auto chunkTable = effectiveChunkTable(*ptr);
+        uint32_t count = 0;
+        for (const auto &entry : chunkTable) {
+            if (entry.first != 0) {
+                ++count;
+            }
         }
 
-        appendUint32(count);
+        std::vector<uint8_t> output;
+        output.reserve(4 + count * 12);
+        appendUint32(output, count, Common::kLittleEndian);
 
-        for (const auto &entry : ptr->dir->chunkInfo) {
-            const auto &info = entry.second;
-            const int32_t idValue = entry.first;
-            if (idValue == 0) {
+        for (const auto &entry : chunkTable) {
+            if (entry.first == 0) {
                 continue;
             }
-            Common::BufferView chunkView = ptr->dir->getChunkData(info.fourCC, idValue);
-
-            appendUint32(info.fourCC);
-            appendUint32(static_cast<uint32_t>(idValue));
-            appendUint32(static_cast<uint32_t>(chunkView.size()));
-            if (chunkView.size() > 0) {
-                output.insert(output.end(), chunkView.data(), chunkView.data() + chunkView.size());
+            uint32_t size = 0;
+            auto patched = ptr->patchedChunks.find(entry.first);
+            if (patched != ptr->patchedChunks.end()) {
+                size = static_cast<uint32_t>(patched->second.data.size());
+            } else {
+                size = ptr->dir->chunkInfo.at(entry.first).uncompressedLen;
             }
-        }
-
-        if (output.empty()) {
-            return nullptr;
+            appendUint32(output, entry.second, Common::kLittleEndian);
+            appendUint32(output, static_cast<uint32_t>(entry.first), Common::kLittleEndian);
+            appendUint32(output, size, Common::kLittleEndian);
         }
 
         uint8_t *out = static_cast<uint8_t *>(std::malloc(output.size()));
@@ -442,6 +1551,13 @@ EMSCRIPTEN_KEEPALIVE uint8_t *projectorrays_implemented_write_to_buffer(uintptr_
             return nullptr;
         }
 
+        // DirectorFile::write knows nothing about pending edits, so route those through the
+        // incremental writer with the same unprotect/restore behaviour.
+        if (!ptr->patchedChunks.empty() || !ptr->removedChunks.empty()) {
+            return writeIncrementalToBuffer(*ptr, kWriteUnprotect | kWriteRestoreScriptText,
+                                            outputSize);
+        }
+
         ptr->dir->config->unprotect();
         ptr->dir->parseScripts();
         ptr->dir->restoreScriptText();
@@ -463,6 +1579,116 @@ EMSCRIPTEN_KEEPALIVE uint8_t *projectorrays_implemented_write_to_buffer(uintptr_
     }
 }
 
+EMSCRIPTEN_KEEPALIVE uint8_t *projectorrays_write_incremental(uintptr_t handle, uint32_t flags,
+                                                             size_t *outputSize) {
+    if (!handle || !outputSize) {
+        return nullptr;
+    }
+
+    *outputSize = 0;
+
+    try {
+        auto *ptr = handleFromId(handle);
+        if (!ptr || !ptr->dir) {
+            return nullptr;
+        }
+        return writeIncrementalToBuffer(*ptr, flags, outputSize);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+EMSCRIPTEN_KEEPALIVE uint8_t *projectorrays_write_afterburned(uintptr_t handle, uint32_t flags,
+                                                             int32_t level, int32_t threadCount,
+                                                             size_t *outputSize) {
+    if (!handle || !outputSize) {
+        return nullptr;
+    }
+
+    *outputSize = 0;
+
+    try {
+        auto *ptr = handleFromId(handle);
+        if (!ptr || !ptr->dir) {
+            return nullptr;
+        }
+        return writeAfterburnedToBuffer(*ptr, flags, level,
+                                        static_cast<unsigned>(std::max(threadCount, 0)),
+                                        outputSize);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+// How far past the highest chunk id a new chunk may go. The writers emit one mmap entry per id up
+// to the highest, so an arbitrary id would make every later write allocate that many entries.
+static const int32_t kMaxNewChunkIdGap = 1024;
+
+// Returns 1 on success, -1 if `id` is reserved or too far past the file's highest chunk id, and 0
+// on any other failure.
+EMSCRIPTEN_KEEPALIVE int projectorrays_set_chunk(uintptr_t handle, uint32_t fourCC, int32_t id,
+                                                 const uint8_t *data, size_t dataSize) {
+    if (!handle || (!data && dataSize > 0)) {
+        return 0;
+    }
+    // Ids 0-2 belong to the RIFX container, the imap and the mmap.
+    if (id <= 2) {
+        return -1;
+    }
+
+    try {
+        auto *ptr = handleFromId(handle);
+        if (!ptr || !ptr->dir) {
+            return 0;
+        }
+
+        int32_t maxId = 2;
+        if (!ptr->dir->chunkInfo.empty()) {
+            maxId = std::max(maxId, ptr->dir->chunkInfo.rbegin()->first);
+        }
+        if (!ptr->patchedChunks.empty()) {
+            maxId = std::max(maxId, ptr->patchedChunks.rbegin()->first);
+        }
+        if (id - maxId > kMaxNewChunkIdGap) {
+            return -1;
+        }
+
+        PatchedChunk &patch = ptr->patchedChunks[id];
+        patch.fourCC = fourCC;
+        patch.data.assign(data, data + dataSize);
+        ptr->removedChunks.erase(id);
+        return 1;
+    } catch (...) {
+        return 0;
+    }
+}
+
+EMSCRIPTEN_KEEPALIVE int projectorrays_remove_chunk(uintptr_t handle, uint32_t fourCC,
+                                                    int32_t id) {
+    if (!handle || id <= 2) {
+        return 0;
+    }
+
+    try {
+        auto *ptr = handleFromId(handle);
+        if (!ptr || !ptr->dir) {
+            return 0;
+        }
+
+        Common::BufferView view;
+        if (!findChunkView(*ptr, fourCC, id, view)) {
+            return 0;
+        }
+        ptr->patchedChunks.erase(id);
+        if (ptr->dir->chunkInfo.count(id)) {
+            ptr->removedChunks.insert(id);
+        }
+        return 1;
+    } catch (...) {
+        return 0;
+    }
+}
+
 EMSCRIPTEN_KEEPALIVE uint8_t *projectorrays_implemented_dump_scripts(uintptr_t handle,
                                                                      size_t *outputSize) {
     if (!handle || !outputSize) {
@@ -495,44 +1721,13 @@ EMSCRIPTEN_KEEPALIVE uint8_t *projectorrays_implemented_dump_scripts(uintptr_t h
             json.writeKey("scripts");
             json.startArray();
             for (const auto &entry : cast->lctx->scripts) {
-                auto script = entry.second;
-                auto scriptChunk = static_cast<Director::ScriptChunk *>(script);
+                auto scriptChunk = static_cast<Director::ScriptChunk *>(entry.second);
                 Director::CastMemberChunk *member = scriptChunk->member;
                 if (!member) {
                     continue;
                 }
 
-                std::string scriptType;
-                if (member->type == Director::kScriptMember) {
-                    auto scriptMember = static_cast<Director::ScriptMember *>(member->member.get());
-                    switch (scriptMember->scriptType) {
-                    case Director::kScoreScript:
-                        scriptType = (ptr->dir->version >= 600) ? "BehaviorScript" : "ScoreScript";
-                        break;
-                    case Director::kMovieScript:
-                        scriptType = "MovieScript";
-                        break;
-                    case Director::kParentScript:
-                        scriptType = "ParentScript";
-                        break;
-                    default:
-                        scriptType = "UnknownScript";
-                        break;
-                    }
-                } else {
-                    scriptType = "CastScript";
-                }
-
-                json.startObject();
-                json.writeField("scriptId", static_cast<int>(entry.first));
-                json.writeField("memberId", static_cast<int>(member->id));
-                json.writeField("memberName", member->getName());
-                json.writeField("scriptType", scriptType);
-                json.writeKey("lingo");
-                json.writeVal(script->scriptText("\n", ptr->dir->dotSyntax));
-                json.writeKey("bytecode");
-                json.writeVal(script->bytecodeText("\n", ptr->dir->dotSyntax));
-                json.endObject();
+                writeScriptEntry(json, *ptr->dir, entry.first, scriptChunk, member);
             }
             json.endArray();
             json.endObject();
@@ -557,6 +1752,534 @@ EMSCRIPTEN_KEEPALIVE uint8_t *projectorrays_implemented_dump_scripts(uintptr_t h
     }
 }
 
+// Per-member metadata as little-endian columns, for loading straight into typed arrays:
+//
+//   uint32 rowCount, uint32 castCount, uint32 stringsSize
+//   int32  memberId[rowCount]
+//   int32  castIndex[rowCount]      index into the cast names
+//   uint8  type[rowCount]           Director::MemberType
+//   uint8  scriptType[rowCount]     Director::ScriptType for script members, else 0
+//   int32  width[rowCount], int32 height[rowCount], uint8 depth[rowCount]   bitmaps, else 0
+//   uint32 soundMedia[rowCount]     fourCC of the chunk holding a sound member's samples, else 0
+//   uint32 soundFormat[rowCount]    sample format of a sound member (see below), else 0
+//   int32  sampleRate[rowCount], uint8 sampleSize[rowCount], uint8 channelCount[rowCount]
+//   int32  nameOffsets[rowCount + 1], int32 castNameOffsets[castCount + 1]
+//   uint8  strings[stringsSize]     UTF-8 member names followed by the cast names
+//
+// Every uint8 column and the string pool are zero-padded to a multiple of 4 bytes.
+//
+// soundMedia is `snd `, `sndS` or `ediM`. soundFormat is the sample format as a QuickTime-style
+// OSType: `raw ` for 8-bit and `twos` for wider uncompressed samples, or the codec (`MAC3`,
+// `ima4`, ...) of a compressed header. It comes from the `snd ` chunk itself or from the `sndH`
+// chunk next to `sndS` samples. `ediM` media (SWA, MP3) isn't parsed, so soundFormat and the
+// rate, size and channel columns are 0 for it and for any header that fails to parse.
+EMSCRIPTEN_KEEPALIVE uint8_t *projectorrays_cast_catalog(uintptr_t handle, size_t *outputSize) {
+    if (!handle || !outputSize) {
+        return nullptr;
+    }
+
+    *outputSize = 0;
+
+    try {
+        auto *ptr = handleFromId(handle);
+        if (!ptr || !ptr->dir) {
+            return nullptr;
+        }
+        Director::DirectorFile &dir = *ptr->dir;
+
+        // Media chunks owned by each CASt chunk, from the key table.
+        std::multimap<int32_t, std::pair<int32_t, uint32_t>> mediaChunks;
+        if (dir.keyTable) {
+            for (const auto &entry : dir.keyTable->entries) {
+                mediaChunks.emplace(entry.castID, std::make_pair(entry.sectionID, entry.fourCC));
+            }
+        }
+
+        CastCatalog catalog;
+        catalog.nameOffsets.push_back(0);
+        for (size_t castIndex = 0; castIndex < dir.casts.size(); ++castIndex) {
+            for (int32_t sectionId : dir.casts[castIndex]->memberIDs) {
+                if (sectionId <= 0) {
+                    continue;
+                }
+                std::shared_ptr<Director::CastMemberChunk> member;
+                try {
+                    member = std::static_pointer_cast<Director::CastMemberChunk>(
+                        dir.getChunk(FOURCC('C', 'A', 'S', 't'), sectionId));
+                } catch (...) {
+                    continue;
+                }
+                if (!member) {
+                    continue;
+                }
+
+                uint8_t scriptType = 0;
+                int32_t width = 0;
+                int32_t height = 0;
+                uint8_t depth = 0;
+                uint32_t soundMedia = 0;
+                uint32_t soundFormat = 0;
+                int32_t sampleRate = 0;
+                uint8_t sampleSize = 0;
+                uint8_t channelCount = 0;
+
+                if (member->type == Director::kScriptMember && member->member) {
+                    auto scriptMember = static_cast<Director::ScriptMember *>(member->member.get());
+                    scriptType = static_cast<uint8_t>(scriptMember->scriptType);
+                } else if (member->type == Director::kBitmapMember) {
+                    try {
+                        readBitmapInfo(*member, width, height, depth);
+                    } catch (...) {
+                    }
+                } else if (member->type == Director::kSoundMember) {
+                    // The samples, and the chunk their header is read from.
+                    uint32_t headerFourCC = 0;
+                    int32_t headerId = 0;
+                    auto range = mediaChunks.equal_range(sectionId);
+                    for (auto it = range.first; it != range.second; ++it) {
+                        const int32_t mediaId = it->second.first;
+                        const uint32_t mediaFourCC = it->second.second;
+                        if (mediaFourCC == FOURCC('s', 'n', 'd', ' ') ||
+                            mediaFourCC == FOURCC('s', 'n', 'd', 'H')) {
+                            headerFourCC = mediaFourCC;
+                            headerId = mediaId;
+                        }
+                        if (!soundMedia && (mediaFourCC == FOURCC('s', 'n', 'd', ' ') ||
+                                            mediaFourCC == FOURCC('s', 'n', 'd', 'S') ||
+                                            mediaFourCC == FOURCC('e', 'd', 'i', 'M'))) {
+                            soundMedia = mediaFourCC;
+                        }
+                    }
+
+                    const bool headerMatches =
+                        (soundMedia == FOURCC('s', 'n', 'd', ' ') &&
+                         headerFourCC == FOURCC('s', 'n', 'd', ' ')) ||
+                        (soundMedia == FOURCC('s', 'n', 'd', 'S') &&
+                         headerFourCC == FOURCC('s', 'n', 'd', 'H'));
+                    Common::BufferView view;
+                    if (headerMatches && findChunkView(*ptr, headerFourCC, headerId, view)) {
+                        try {
+                            readSoundInfo(view, soundFormat, sampleRate, sampleSize,
+                                          channelCount);
+                        } catch (...) {
+                            soundFormat = 0;
+                        }
+                    }
+                    // No half-parsed headers: without a format, report nothing.
+                    if (!soundFormat) {
+                        sampleRate = 0;
+                        sampleSize = 0;
+                        channelCount = 0;
+                    }
+                }
+
+                catalog.memberId.push_back(static_cast<int32_t>(member->id));
+                catalog.castIndex.push_back(static_cast<int32_t>(castIndex));
+                catalog.type.push_back(static_cast<uint8_t>(member->type));
+                catalog.scriptType.push_back(scriptType);
+                catalog.width.push_back(width);
+                catalog.height.push_back(height);
+                catalog.depth.push_back(depth);
+                catalog.soundMedia.push_back(soundMedia);
+                catalog.soundFormat.push_back(soundFormat);
+                catalog.sampleRate.push_back(sampleRate);
+                catalog.sampleSize.push_back(sampleSize);
+                catalog.channelCount.push_back(channelCount);
+                catalog.strings += member->getName();
+                catalog.nameOffsets.push_back(static_cast<int32_t>(catalog.strings.size()));
+            }
+        }
+
+        catalog.castNameOffsets.push_back(static_cast<int32_t>(catalog.strings.size()));
+        for (const auto &cast : dir.casts) {
+            catalog.strings += cast->name;
+            catalog.castNameOffsets.push_back(static_cast<int32_t>(catalog.strings.size()));
+        }
+
+        std::vector<uint8_t> output;
+        appendUint32(output, static_cast<uint32_t>(catalog.memberId.size()),
+                     Common::kLittleEndian);
+        appendUint32(output, static_cast<uint32_t>(dir.casts.size()), Common::kLittleEndian);
+        appendUint32(output, static_cast<uint32_t>(catalog.strings.size()),
+                     Common::kLittleEndian);
+        appendInt32Column(output, catalog.memberId);
+        appendInt32Column(output, catalog.castIndex);
+        appendUint8Column(output, catalog.type);
+        appendUint8Column(output, catalog.scriptType);
+        appendInt32Column(output, catalog.width);
+        appendInt32Column(output, catalog.height);
+        appendUint8Column(output, catalog.depth);
+        appendUint32Column(output, catalog.soundMedia);
+        appendUint32Column(output, catalog.soundFormat);
+        appendInt32Column(output, catalog.sampleRate);
+        appendUint8Column(output, catalog.sampleSize);
+        appendUint8Column(output, catalog.channelCount);
+        appendInt32Column(output, catalog.nameOffsets);
+        appendInt32Column(output, catalog.castNameOffsets);
+        output.insert(output.end(), catalog.strings.begin(), catalog.strings.end());
+        appendPadding(output);
+
+        uint8_t *out = static_cast<uint8_t *>(std::malloc(output.size()));
+        if (!out) {
+            return nullptr;
+        }
+        std::memcpy(out, output.data(), output.size());
+        *outputSize = output.size();
+        return out;
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+struct ProjectorRaysJob {
+    ProjectorRaysHandle *handle = nullptr;
+    uint32_t kind = kJobDumpScripts;
+    uint32_t done = 0;
+    uint32_t total = 0;
+    bool failed = false;
+
+    // kJobDumpScripts: every cast with a script context and the ids of its scripts, plus a cursor
+    // into them. The JSON is built up across steps.
+    std::vector<std::pair<Director::CastChunk *, std::vector<int32_t>>> scriptCasts;
+    size_t castIndex = 0;
+    size_t scriptIndex = 0;
+    bool castOpen = false;
+    std::unique_ptr<Common::JSONWriter> json;
+
+    // kJobDumpJSON: the chunks to serialize, in chunkInfo order.
+    std::vector<std::pair<int32_t, uint32_t>> chunks;
+    std::string text;
+
+    // kJobWriteToBuffer: the write plan, the header of RIFX output, and for Afterburner output the
+    // streams to deflate, `deflateBatch` of them per unit.
+    uint32_t writeMode = kJobWriteFull;
+    WritePlan plan;
+    uint32_t codec = 0;
+    std::vector<uint8_t> imapData;
+    AfterburnerWrite afterburner;
+    size_t deflateBatch = 1;
+
+    // Result once done == total, allocated with malloc and released with the job.
+    uint8_t *output = nullptr;
+    size_t outputSize = 0;
+
+    ~ProjectorRaysJob() { std::free(output); }
+};
+
+static ProjectorRaysJob *jobFromId(uintptr_t job) {
+    return reinterpret_cast<ProjectorRaysJob *>(job);
+}
+
+static bool setJobOutput(ProjectorRaysJob &job, const std::string &output) {
+    if (output.empty()) {
+        return false;
+    }
+    job.output = static_cast<uint8_t *>(std::malloc(output.size()));
+    if (!job.output) {
+        return false;
+    }
+    std::memcpy(job.output, output.data(), output.size());
+    job.outputSize = output.size();
+    return true;
+}
+
+// Open the next cast in the script dump if needed, closing any that have no scripts left.
+static void advanceScriptCast(ProjectorRaysJob &job) {
+    while (job.castIndex < job.scriptCasts.size()) {
+        const auto &entry = job.scriptCasts[job.castIndex];
+        if (!job.castOpen) {
+            job.json->startObject();
+            job.json->writeField("name", entry.first->name);
+            job.json->writeKey("scripts");
+            job.json->startArray();
+            job.castOpen = true;
+        }
+        if (job.scriptIndex < entry.second.size()) {
+            return;
+        }
+        job.json->endArray();
+        job.json->endObject();
+        job.castOpen = false;
+        ++job.castIndex;
+        job.scriptIndex = 0;
+    }
+}
+
+// Every unit parses and decompiles one script.
+static bool runDumpScriptsUnit(ProjectorRaysJob &job) {
+    Director::DirectorFile &dir = *job.handle->dir;
+    advanceScriptCast(job);
+    if (job.castIndex >= job.scriptCasts.size()) {
+        return true;
+    }
+    Director::CastChunk *cast = job.scriptCasts[job.castIndex].first;
+    const int32_t scriptId = job.scriptCasts[job.castIndex].second[job.scriptIndex++];
+    auto it = cast->lctx->scripts.find(scriptId);
+    if (it == cast->lctx->scripts.end()) {
+        return true;
+    }
+    auto scriptChunk = static_cast<Director::ScriptChunk *>(it->second);
+    scriptChunk->parse();
+    if (scriptChunk->member) {
+        writeScriptEntry(*job.json, dir, scriptId, scriptChunk, scriptChunk->member);
+    }
+    return true;
+}
+
+static bool finishDumpScripts(ProjectorRaysJob &job) {
+    advanceScriptCast(job);
+    job.json->endArray();
+    job.json->endObject();
+    return setJobOutput(job, standardizeJsonEscapes(job.json->str()));
+}
+
+// Every unit serializes one chunk; chunks that fail to parse are left out, as in dump_json.
+static bool runDumpJSONUnit(ProjectorRaysJob &job) {
+    Director::DirectorFile &dir = *job.handle->dir;
+    const int32_t id = job.chunks[job.done].first;
+    const uint32_t fourCC = job.chunks[job.done].second;
+    try {
+        auto chunk = dir.getChunk(fourCC, id);
+        if (!chunk) {
+            return true;
+        }
+
+        Common::JSONWriter json("\n");
+        chunk->writeJSON(json);
+        std::string chunkJson = standardizeJsonEscapes(json.str());
+        if (chunkJson.empty()) {
+            return true;
+        }
+
+        if (job.text.size() > 1) {
+            job.text += ",";
+        }
+        job.text += "{\"fourCC\":\"";
+        job.text += Common::escapeString(Common::fourCCToString(fourCC));
+        job.text += "\",\"id\":";
+        job.text += std::to_string(id);
+        job.text += ",\"data\":";
+        job.text += chunkJson;
+        job.text += "}";
+    } catch (...) {
+    }
+    return true;
+}
+
+static bool finishDumpJSON(ProjectorRaysJob &job) {
+    job.text += "]";
+    return setJobOutput(job, standardizeJsonEscapes(job.text));
+}
+
+// One unit per script parsed and restored, then one per chunk serialized or copied (reused
+// Afterburner resources need none), then for Afterburner output one per batch of streams
+// deflated, and a last one that lays the file out.
+static bool runWriteUnit(ProjectorRaysJob &job) {
+    ProjectorRaysHandle &handle = *job.handle;
+    WritePlan &plan = job.plan;
+
+    size_t unit = job.done;
+    if (unit < plan.scripts.size()) {
+        restoreWriteScript(*handle.dir, plan.scripts[unit]);
+        return true;
+    }
+    unit -= plan.scripts.size();
+    if (unit < plan.loads.size()) {
+        return loadWriteChunk(handle, plan, plan.loads[unit]);
+    }
+    unit -= plan.loads.size();
+
+    if (job.writeMode == kJobWriteAfterburned) {
+        const size_t streamCount = job.afterburner.streamCount();
+        const size_t first = unit * job.deflateBatch;
+        if (first < streamCount) {
+            const size_t count = std::min(job.deflateBatch, streamCount - first);
+            runParallel(count, static_cast<unsigned>(job.deflateBatch), [&job, first](size_t i) {
+                deflateAfterburnedStream(job.afterburner, first + i);
+            });
+            return true;
+        }
+        job.output = layoutAfterburnedWrite(handle, job.afterburner, &job.outputSize);
+        return job.output != nullptr;
+    }
+
+    job.output = layoutIncrementalWrite(handle, plan, job.codec, job.imapData, &job.outputSize);
+    return job.output != nullptr;
+}
+
+EMSCRIPTEN_KEEPALIVE uintptr_t projectorrays_job_start(uintptr_t handle, uint32_t kind,
+                                                       uint32_t writeMode, uint32_t writeFlags,
+                                                       int32_t level, int32_t threadCount) {
+    if (!handle) {
+        return 0;
+    }
+
+    try {
+        auto *ptr = handleFromId(handle);
+        if (!ptr || !ptr->dir) {
+            return 0;
+        }
+
+        auto job = std::make_unique<ProjectorRaysJob>();
+        job->handle = ptr;
+        job->kind = kind;
+
+        switch (kind) {
+        case kJobDumpScripts:
+            ptr->dir->config->unprotect();
+            for (const auto &cast : ptr->dir->casts) {
+                if (!cast->lctx) {
+                    continue;
+                }
+                std::vector<int32_t> scriptIds;
+                for (const auto &entry : cast->lctx->scripts) {
+                    scriptIds.push_back(entry.first);
+                }
+                job->total += static_cast<uint32_t>(scriptIds.size());
+                job->scriptCasts.emplace_back(cast.get(), std::move(scriptIds));
+            }
+            job->json = std::make_unique<Common::JSONWriter>("\n");
+            job->json->startObject();
+            job->json->writeField("isCast", ptr->dir->isCast() ? 1 : 0);
+            job->json->writeField("version", static_cast<int>(ptr->dir->version));
+            job->json->writeKey("casts");
+            job->json->startArray();
+            break;
+        case kJobDumpJSON:
+            for (const auto &entry : ptr->dir->chunkInfo) {
+                if (entry.second.id == 0) {
+                    continue;
+                }
+                job->chunks.emplace_back(entry.second.id, entry.second.fourCC);
+            }
+            job->total = static_cast<uint32_t>(job->chunks.size());
+            job->text = "[";
+            break;
+        case kJobWriteToBuffer: {
+            if (writeMode > kJobWriteAfterburned) {
+                return 0;
+            }
+            job->writeMode = writeMode;
+            uint32_t flags = writeFlags;
+            if (writeMode == kJobWriteFull) {
+                // DirectorFile::write can't be split into steps, so a full write is laid out by
+                // the incremental writer with every parsed chunk re-serialized. Pending edits are
+                // written as by the sync path.
+                flags = kWriteUnprotect | kWriteRestoreScriptText;
+                if (ptr->patchedChunks.empty() && ptr->removedChunks.empty()) {
+                    flags |= kWriteReserializeAll;
+                }
+            }
+            if (writeMode != kJobWriteAfterburned &&
+                !readIncrementalHeader(*ptr, job->codec, job->imapData)) {
+                return 0;
+            }
+
+            beginWrite(*ptr, flags, job->plan);
+            if (writeMode == kJobWriteAfterburned) {
+                planAfterburnedWrite(*ptr, flags, level, job->plan, job->afterburner);
+            }
+            size_t total = job->plan.scripts.size() + job->plan.loads.size() + 1;
+            if (writeMode == kJobWriteAfterburned) {
+                job->deflateBatch =
+                    parallelThreadCount(static_cast<unsigned>(std::max(threadCount, 0)));
+                const size_t streamCount = job->afterburner.streamCount();
+                total += (streamCount + job->deflateBatch - 1) / job->deflateBatch;
+            }
+            job->total = static_cast<uint32_t>(total);
+            break;
+        }
+        default:
+            return 0;
+        }
+
+        return reinterpret_cast<uintptr_t>(job.release());
+    } catch (...) {
+        return 0;
+    }
+}
+
+// Run up to `budget` units of work. Returns 1 while there is more to do, 0 once the result is
+// ready and -1 if the job failed.
+EMSCRIPTEN_KEEPALIVE int projectorrays_job_step(uintptr_t jobId, uint32_t budget) {
+    auto *job = jobFromId(jobId);
+    if (!job || job->failed) {
+        return -1;
+    }
+
+    try {
+        for (uint32_t i = 0; i < budget && job->done < job->total; ++i) {
+            bool ok = false;
+            switch (job->kind) {
+            case kJobDumpScripts:
+                ok = runDumpScriptsUnit(*job);
+                break;
+            case kJobDumpJSON:
+                ok = runDumpJSONUnit(*job);
+                break;
+            case kJobWriteToBuffer:
+                ok = runWriteUnit(*job);
+                break;
+            }
+            if (!ok) {
+                job->failed = true;
+                return -1;
+            }
+            ++job->done;
+        }
+
+        if (job->done < job->total) {
+            return 1;
+        }
+        if (!job->output) {
+            bool ok = true;
+            if (job->kind == kJobDumpScripts) {
+                ok = finishDumpScripts(*job);
+            } else if (job->kind == kJobDumpJSON) {
+                ok = finishDumpJSON(*job);
+            }
+            if (!ok || !job->output) {
+                job->failed = true;
+                return -1;
+            }
+        }
+        return 0;
+    } catch (...) {
+        job->failed = true;
+        return -1;
+    }
+}
+
+EMSCRIPTEN_KEEPALIVE uint32_t projectorrays_job_done(uintptr_t jobId) {
+    auto *job = jobFromId(jobId);
+    return job ? job->done : 0;
+}
+
+EMSCRIPTEN_KEEPALIVE uint32_t projectorrays_job_total(uintptr_t jobId) {
+    auto *job = jobFromId(jobId);
+    return job ? job->total : 0;
+}
+
+// The finished result. The buffer belongs to the job and is freed by projectorrays_job_free.
+EMSCRIPTEN_KEEPALIVE uint8_t *projectorrays_job_result(uintptr_t jobId, size_t *outputSize) {
+    if (!outputSize) {
+        return nullptr;
+    }
+    *outputSize = 0;
+
+    auto *job = jobFromId(jobId);
+    if (!job || job->failed || job->done < job->total || !job->output) {
+        return nullptr;
+    }
+    *outputSize = job->outputSize;
+    return job->output;
+}
+
+EMSCRIPTEN_KEEPALIVE void projectorrays_job_free(uintptr_t jobId) {
+    auto *job = jobFromId(jobId);
+    delete job;
+}
+
 EMSCRIPTEN_KEEPALIVE void projectorrays_free(uint8_t *buffer) { std::free(buffer); }
 
 } // extern "C"
@@ -0,0 +1,85 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef PROJECTORRAYS_WASM_PROJECTORRAYS_H
+#define PROJECTORRAYS_WASM_PROJECTORRAYS_H
+
+#include <cstddef>
+#include <cstdint>
+
+// The C entry points implemented in main.cpp. The wasm module exports them to the TS wrapper, and
+// the native batch command links against them directly. Buffers returned through an outputSize
+// pointer are allocated with malloc and released with projectorrays_free, unless noted otherwise.
+
+extern "C" {
+
+// Flags accepted by projectorrays_write_incremental and projectorrays_write_afterburned.
+enum IncrementalWriteFlags : uint32_t {
+    kWriteUnprotect = 1 << 0,
+    kWriteRestoreScriptText = 1 << 1,
+    // Afterburner output only: copy unmodified chunks of an Afterburner input without
+    // recompressing them.
+    kWriteKeepCompressed = 1 << 2,
+};
+
+// Operations that JS can run a few units at a time through projectorrays_job_step, so that it
+// can yield to the event loop, report progress and cancel in between.
+enum JobKind : uint32_t {
+    kJobDumpScripts = 0,
+    kJobDumpJSON = 1,
+    kJobWriteToBuffer = 2,
+};
+
+// Output format of a kJobWriteToBuffer job, matching the synchronous write entry points.
+enum JobWriteMode : uint32_t {
+    kJobWriteFull = 0,
+    kJobWriteIncremental = 1,
+    kJobWriteAfterburned = 2,
+};
+
+uintptr_t projectorrays_read(const uint8_t *input, size_t inputSize);
+// Reading without the copy projectorrays_read makes: write the file into the returned buffer, which
+// belongs to *handle, then parse it with projectorrays_read_input. The handle must be freed with
+// projectorrays_free_handle whether or not parsing succeeds.
+uint8_t *projectorrays_alloc_input(size_t inputSize, uintptr_t *handle);
+int projectorrays_read_input(uintptr_t handle);
+void projectorrays_free_handle(uintptr_t handle);
+
+int projectorrays_chunk_exists(uintptr_t handle, uint32_t fourCC, int32_t id);
+int projectorrays_is_cast(uintptr_t handle);
+int projectorrays_size(uintptr_t handle);
+uint8_t *projectorrays_get_chunk(uintptr_t handle, uint32_t fourCC, int32_t id, size_t *outputSize);
+uint8_t *projectorrays_get_script(uintptr_t handle, int32_t id, size_t *outputSize);
+
+uint8_t *projectorrays_implemented_dump_json(uintptr_t handle, size_t *outputSize);
+uint8_t *projectorrays_implemented_dump_chunks(uintptr_t handle, size_t *outputSize);
+uint8_t *projectorrays_list_chunks(uintptr_t handle, size_t *outputSize);
+uint8_t *projectorrays_implemented_dump_scripts(uintptr_t handle, size_t *outputSize);
+uint8_t *projectorrays_cast_catalog(uintptr_t handle, size_t *outputSize);
+
+uint8_t *projectorrays_implemented_write_to_buffer(uintptr_t handle, size_t *outputSize);
+uint8_t *projectorrays_write_incremental(uintptr_t handle, uint32_t flags, size_t *outputSize);
+uint8_t *projectorrays_write_afterburned(uintptr_t handle, uint32_t flags, int32_t level,
+                                         int32_t threadCount, size_t *outputSize);
+
+int projectorrays_set_chunk(uintptr_t handle, uint32_t fourCC, int32_t id, const uint8_t *data,
+                            size_t dataSize);
+int projectorrays_remove_chunk(uintptr_t handle, uint32_t fourCC, int32_t id);
+
+uintptr_t projectorrays_job_start(uintptr_t handle, uint32_t kind, uint32_t writeMode,
+                                  uint32_t writeFlags, int32_t level, int32_t threadCount);
+int projectorrays_job_step(uintptr_t jobId, uint32_t budget);
+uint32_t projectorrays_job_done(uintptr_t jobId);
+uint32_t projectorrays_job_total(uintptr_t jobId);
+// The result stays owned by the job and is released by projectorrays_job_free.
+uint8_t *projectorrays_job_result(uintptr_t jobId, size_t *outputSize);
+void projectorrays_job_free(uintptr_t jobId);
+
+void projectorrays_free(uint8_t *buffer);
+
+} // extern "C"
+
+#endif // PROJECTORRAYS_WASM_PROJECTORRAYS_H
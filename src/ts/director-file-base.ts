@@ -1,8 +1,26 @@
-import { DirectorChunk, DirectorChunkId, DirectorChunkJSON, DirectorScriptDetail, DirectorScriptDump, DirectorScriptType, ReadInput } from ".";
+import { DirectorAsyncOptions, DirectorCastCatalog, DirectorChunk, DirectorChunkId, DirectorChunkJSON, DirectorScriptDetail, DirectorScriptDump, DirectorScriptType, DirectorWriteOptions, ReadInput } from ".";
 import { loadProjectorRays, type ProjectorRaysLoaderOptions, type ProjectorRaysModule } from "./loader";
 import { fourCCToString } from "./util/fourCCToString";
 import { normalizeFourCC } from "./util/normalizeFourCC";
+import { refreshHeapViews } from "./util/refreshHeapViews";
 import { toUint8Array } from "./util/toUint8Array";
+import { yieldToEventLoop } from "./util/yieldToEventLoop";
+
+// These mirror JobKind, JobWriteMode and IncrementalWriteFlags in projectorrays.h.
+const JOB_DUMP_SCRIPTS = 0;
+const JOB_DUMP_JSON = 1;
+const JOB_WRITE_TO_BUFFER = 2;
+
+const JOB_WRITE_FULL = 0;
+const JOB_WRITE_INCREMENTAL = 1;
+const JOB_WRITE_AFTERBURNED = 2;
+
+const WRITE_UNPROTECT = 1 << 0;
+const WRITE_RESTORE_SCRIPT_TEXT = 1 << 1;
+const WRITE_KEEP_COMPRESSED = 1 << 2;
+
+// kMaxNewChunkIdGap in main.cpp.
+const MAX_NEW_CHUNK_ID_GAP = 1024;
 
 function assertWasmModule(module: ProjectorRaysModule): asserts module is Required<ProjectorRaysModule> {
     if (!module.cwrap || !module.HEAPU8 || !module.HEAPU32 || !module._malloc || !module._free) {
@@ -15,6 +33,7 @@ export abstract class DirectorFileBase {
     #input: Uint8Array;
     #handle: number | null;
     #destroyed: boolean;
+    #jobs: Set<number>;
     #module: ProjectorRaysModule;
 
     protected constructor(
@@ -25,6 +44,7 @@ export abstract class DirectorFileBase {
         this.#input = toUint8Array(_input);
         this.#handle = null;
         this.#destroyed = false;
+        this.#jobs = new Set();
 
         if (!this.#read()) {
             throw new Error("Failed to read DirectorFile");
@@ -114,6 +134,60 @@ export abstract class DirectorFileBase {
         }
     }
 
+    /**
+     * Replace the chunk with this id, or add a new one if the id is unused.
+     * fourCC can be a 4-character string (e.g. "BITD") or a numeric code.
+     * The change is seen by `chunkExists`, `getChunk`, `dumpChunks` and `writeToBuffer`;
+     * parsed views such as `dumpJSON` and `dumpScripts` still reflect the original file.
+     * @throws RangeError if `id` is 0-2 or more than 1024 past the highest id in the file.
+     */
+    setChunk(fourCC: number | string, id: DirectorChunkId, data: ReadInput): void {
+        this.#ensureHandle("setChunk");
+        assertWasmModule(this.#module);
+        const fourCCValue = normalizeFourCC(fourCC);
+        const bytes = toUint8Array(data);
+        const func = this.#module.cwrap("projectorrays_set_chunk", "number", [
+            "number",
+            "number",
+            "number",
+            "number",
+            "number",
+        ]);
+        const dataPtr = this.#module._malloc(Math.max(bytes.length, 1));
+        try {
+            this.#module.HEAPU8.set(bytes, dataPtr);
+            const result = func(this.#handle, fourCCValue, id, dataPtr, bytes.length);
+            if (result < 0) {
+                throw new RangeError(
+                    `Invalid chunk id ${id}: ids 0-2 are reserved, and a new chunk's id may be at ` +
+                        `most ${MAX_NEW_CHUNK_ID_GAP} past the highest id in the file`
+                );
+            }
+            if (!result) {
+                throw new Error(`Failed to set chunk ${fourCCToString(fourCCValue)} ${id}`);
+            }
+        } finally {
+            this.#module._free(dataPtr);
+        }
+    }
+
+    /**
+     * Remove a chunk by fourCC and id.
+     * fourCC can be a 4-character string (e.g. "BITD") or a numeric code.
+     * @returns `true` if the chunk was removed, `false` if it did not exist.
+     */
+    removeChunk(fourCC: number | string, id: DirectorChunkId): boolean {
+        this.#ensureHandle("removeChunk");
+        assertWasmModule(this.#module);
+        const fourCCValue = normalizeFourCC(fourCC);
+        const func = this.#module.cwrap("projectorrays_remove_chunk", "number", [
+            "number",
+            "number",
+            "number",
+        ]);
+        return Boolean(func(this.#handle, fourCCValue, id));
+    }
+
     /**
      * Fetch a specific script entry by script id.
      * @returns a script detail object.
@@ -171,13 +245,52 @@ export abstract class DirectorFileBase {
 
     /**
      * Write an unprotected version of the file to a buffer.
+     * Pass `{ incremental: true }` to copy unchanged chunks straight from the input, or
+     * `{ afterburner: true }` to write a compressed Afterburner (`.dcr`/`.cct`) file.
      * @returns a buffer containing the unprotected file contents.
      */
-    writeToBuffer(): Uint8Array {
+    writeToBuffer(options: DirectorWriteOptions = {}): Uint8Array {
         this.#ensureHandle("writeToBuffer");
+        const flags = this.#writeFlags(options);
+        if (options.afterburner) {
+            return this.#callWriter("projectorrays_write_afterburned", [
+                flags,
+                options.compressionLevel ?? -1,
+                options.threads ?? 0,
+            ]);
+        }
+        if (options.incremental) {
+            return this.#callWriter("projectorrays_write_incremental", [flags]);
+        }
         return this.#callHandle("projectorrays_implemented_write_to_buffer");
     }
 
+    /**
+     * Like `writeToBuffer`, but restores one script, writes one chunk or deflates one stream at a
+     * time and yields to the event loop in between. The file is written as it stood when the call
+     * was made: `setChunk` and `removeChunk` calls made while it runs don't affect it.
+     *
+     * Without `incremental` or `afterburner`, the output is not byte-identical to
+     * `writeToBuffer()`: it holds the same chunks, laid out by the incremental writer, because a
+     * full write cannot be split into steps. With either option both return the same bytes.
+     * @returns a buffer containing the unprotected file contents.
+     */
+    async writeToBufferAsync(
+        options: DirectorWriteOptions & DirectorAsyncOptions = {}
+    ): Promise<Uint8Array> {
+        this.#ensureHandle("writeToBufferAsync");
+        const mode = options.afterburner
+            ? JOB_WRITE_AFTERBURNED
+            : options.incremental
+              ? JOB_WRITE_INCREMENTAL
+              : JOB_WRITE_FULL;
+        return this.#runJob(
+            JOB_WRITE_TO_BUFFER,
+            [mode, this.#writeFlags(options), options.compressionLevel ?? -1, options.threads ?? 0],
+            options
+        );
+    }
+
     /**
      * Dump script metadata, source, and bytecode.
      * @returns a script dump object.
@@ -203,6 +316,17 @@ export abstract class DirectorFileBase {
         return this.#normalizeScriptDump(decoded);
     }
 
+    /**
+     * Same as `dumpScripts`, but parses and decompiles one script at a time and yields to the
+     * event loop in between.
+     * @returns a script dump object.
+     */
+    async dumpScriptsAsync(options: DirectorAsyncOptions = {}): Promise<DirectorScriptDump> {
+        this.#ensureHandle("dumpScriptsAsync");
+        const output = await this.#runJob(JOB_DUMP_SCRIPTS, [0, 0, 0, 0], options);
+        return this.#normalizeScriptDump(JSON.parse(new TextDecoder("utf-8").decode(output)));
+    }
+
     /**
      * Dump all chunks as raw bytes.
      * @returns an array of chunk objects.
@@ -226,6 +350,31 @@ export abstract class DirectorFileBase {
         );
     }
 
+    /**
+     * Same as `dumpJSON`, but serializes one chunk at a time and yields to the event loop
+     * in between.
+     * @returns an array of chunk JSON objects.
+     */
+    async dumpJSONAsync(options: DirectorAsyncOptions = {}): Promise<DirectorChunkJSON[]> {
+        this.#ensureHandle("dumpJSONAsync");
+        const output = await this.#runJob(JOB_DUMP_JSON, [0, 0, 0, 0], options);
+        const decoded = JSON.parse(new TextDecoder("utf-8").decode(output));
+        return this.#normalizeChunkJSONDump(
+            Array.isArray(decoded) ? decoded : []
+        );
+    }
+
+    /**
+     * Collect id, cast, type, name, script type, bitmap and sound format of every cast member
+     * as typed-array columns, without serializing any chunks.
+     * @returns a columnar cast catalog.
+     */
+    castCatalog(): DirectorCastCatalog {
+        this.#ensureHandle("castCatalog");
+        const output = this.#callHandle("projectorrays_cast_catalog");
+        return this.#decodeCastCatalog(output);
+    }
+
     /**
      * Return whether the file is a cast.
      * @returns `true` if the file is a cast, `false` otherwise.
@@ -244,6 +393,7 @@ export abstract class DirectorFileBase {
         if (this.#destroyed) {
             return;
         }
+        this.#releaseJobs();
         this.#releaseHandle();
         this.#destroyed = true;
     }
@@ -263,6 +413,7 @@ export abstract class DirectorFileBase {
             | "projectorrays_implemented_dump_scripts"
             | "projectorrays_implemented_dump_chunks"
             | "projectorrays_implemented_dump_json"
+            | "projectorrays_cast_catalog"
     ): Uint8Array {
         assertWasmModule(this.#module);
         if (!this.#handle) {
@@ -290,6 +441,141 @@ export abstract class DirectorFileBase {
         }
     }
 
+    #callWriter(
+        name: "projectorrays_write_incremental" | "projectorrays_write_afterburned",
+        args: number[]
+    ): Uint8Array {
+        assertWasmModule(this.#module);
+        const func = this.#module.cwrap(name, "number", [
+            "number",
+            ...args.map(() => "number"),
+            "number",
+        ]);
+        const sizePtr = this.#module._malloc(4);
+
+        let outputPtr = 0;
+        try {
+            this.#module.HEAPU32[sizePtr >> 2] = 0;
+            outputPtr = func(this.#handle, ...args, sizePtr) as number;
+            // Afterburner output is compressed on worker threads, which may have grown the heap.
+            refreshHeapViews(this.#module);
+            const outputSize = this.#module.HEAPU32[sizePtr >> 2];
+            if (!outputPtr || outputSize === 0) {
+                throw new Error(`WASM call failed (no outputPtr or outputSize): ${name}`);
+            }
+            return this.#module.HEAPU8.slice(outputPtr, outputPtr + outputSize);
+        } finally {
+            if (outputPtr) {
+                const free = this.#module.cwrap("projectorrays_free", null, ["number"]);
+                free(outputPtr);
+            }
+            this.#module._free(sizePtr);
+        }
+    }
+
+    #writeFlags(options: DirectorWriteOptions): number {
+        return (
+            (options.unprotect ? WRITE_UNPROTECT : 0) |
+            (options.restoreScripts ? WRITE_RESTORE_SCRIPT_TEXT : 0) |
+            (options.keepCompressed ? WRITE_KEEP_COMPRESSED : 0)
+        );
+    }
+
+    async #runJob(kind: number, args: number[], options: DirectorAsyncOptions): Promise<Uint8Array> {
+        assertWasmModule(this.#module);
+        const { signal, onProgress, sliceMs = 8 } = options;
+        const abortReason = () =>
+            signal?.reason ?? new DOMException("The operation was aborted.", "AbortError");
+        if (signal?.aborted) {
+            throw abortReason();
+        }
+
+        const start = this.#module.cwrap("projectorrays_job_start", "number", [
+            "number",
+            "number",
+            "number",
+            "number",
+            "number",
+            "number",
+        ]);
+        const step = this.#module.cwrap("projectorrays_job_step", "number", ["number", "number"]);
+        const done = this.#module.cwrap("projectorrays_job_done", "number", ["number"]);
+        const total = this.#module.cwrap("projectorrays_job_total", "number", ["number"]);
+
+        const job = start(this.#handle, kind, ...args) as number;
+        if (!job) {
+            throw new Error(`WASM call failed (no job): ${kind}`);
+        }
+        this.#jobs.add(job);
+
+        try {
+            for (;;) {
+                const sliceStart = performance.now();
+                let status = 1;
+                do {
+                    status = step(job, 1) as number;
+                } while (status === 1 && performance.now() - sliceStart < sliceMs);
+
+                if (status < 0) {
+                    throw new Error(`WASM job failed: ${kind}`);
+                }
+                onProgress?.({ done: done(job) as number, total: total(job) as number });
+                // onProgress may have destroyed the file (freeing the job) or aborted the signal.
+                this.#assertJobLive(job, signal, abortReason);
+                if (status === 0) {
+                    break;
+                }
+
+                await yieldToEventLoop();
+                this.#assertJobLive(job, signal, abortReason);
+            }
+
+            const result = this.#module.cwrap("projectorrays_job_result", "number", [
+                "number",
+                "number",
+            ]);
+            const sizePtr = this.#module._malloc(4);
+            try {
+                this.#module.HEAPU32[sizePtr >> 2] = 0;
+                const outputPtr = result(job, sizePtr) as number;
+                refreshHeapViews(this.#module);
+                const outputSize = this.#module.HEAPU32[sizePtr >> 2];
+                if (!outputPtr || outputSize === 0) {
+                    throw new Error(`WASM job failed (no outputPtr or outputSize): ${kind}`);
+                }
+                return this.#module.HEAPU8.slice(outputPtr, outputPtr + outputSize);
+            } finally {
+                this.#module._free(sizePtr);
+            }
+        } finally {
+            this.#releaseJob(job);
+        }
+    }
+
+    #assertJobLive(job: number, signal: AbortSignal | undefined, abortReason: () => unknown): void {
+        if (signal?.aborted) {
+            throw abortReason();
+        }
+        if (!this.#jobs.has(job)) {
+            throw new Error("DirectorFile was destroyed while a job was running.");
+        }
+    }
+
+    #releaseJob(job: number): void {
+        if (!this.#jobs.delete(job)) {
+            return;
+        }
+        assertWasmModule(this.#module);
+        const freeJob = this.#module.cwrap("projectorrays_job_free", null, ["number"]);
+        freeJob(job);
+    }
+
+    #releaseJobs(): void {
+        for (const job of [...this.#jobs]) {
+            this.#releaseJob(job);
+        }
+    }
+
     #decodeChunkDump(output: Uint8Array): DirectorChunk[] {
         const view = new DataView(output.buffer, output.byteOffset, output.byteLength);
         let offset = 0;
@@ -320,6 +606,73 @@ export abstract class DirectorFileBase {
         return chunks;
     }
 
+    #decodeCastCatalog(output: Uint8Array): DirectorCastCatalog {
+        // `output` is a fresh copy, so its buffer starts at offset 0 and every column is
+        // 4-byte aligned as laid out by projectorrays_cast_catalog.
+        const view = new DataView(output.buffer, output.byteOffset, output.byteLength);
+        if (view.byteLength < 12) {
+            throw new Error("Invalid cast catalog (missing header).");
+        }
+        const length = view.getUint32(0, true);
+        const castCount = view.getUint32(4, true);
+        const stringsSize = view.getUint32(8, true);
+        let offset = output.byteOffset + 12;
+        const padded = (size: number) => (size + 3) & ~3;
+        const take = <T>(create: (buffer: ArrayBuffer, offset: number, count: number) => T, count: number, width: number): T => {
+            if (offset - output.byteOffset + padded(count * width) > output.byteLength) {
+                throw new Error("Invalid cast catalog (truncated column).");
+            }
+            const column = create(output.buffer as ArrayBuffer, offset, count);
+            offset += padded(count * width);
+            return column;
+        };
+        const int32 = (count: number) => take((b, o, n) => new Int32Array(b, o, n), count, 4);
+        const uint32 = (count: number) => take((b, o, n) => new Uint32Array(b, o, n), count, 4);
+        const uint8 = (count: number) => take((b, o, n) => new Uint8Array(b, o, n), count, 1);
+
+        const memberId = int32(length);
+        const castIndex = int32(length);
+        const type = uint8(length);
+        const scriptType = uint8(length);
+        const width = int32(length);
+        const height = int32(length);
+        const depth = uint8(length);
+        const soundMedia = uint32(length);
+        const soundFormat = uint32(length);
+        const sampleRate = int32(length);
+        const sampleSize = uint8(length);
+        const channelCount = uint8(length);
+        const nameOffsets = int32(length + 1);
+        const castNameOffsets = int32(castCount + 1);
+        const strings = uint8(stringsSize);
+
+        const decoder = new TextDecoder("utf-8");
+        const castNames: string[] = [];
+        for (let i = 0; i < castCount; i += 1) {
+            castNames.push(decoder.decode(strings.subarray(castNameOffsets[i], castNameOffsets[i + 1])));
+        }
+
+        return {
+            length,
+            memberId,
+            castIndex,
+            type,
+            scriptType,
+            width,
+            height,
+            depth,
+            soundMedia,
+            soundFormat,
+            sampleRate,
+            sampleSize,
+            channelCount,
+            nameOffsets,
+            castNameOffsets,
+            strings,
+            castNames,
+        };
+    }
+
     #normalizeScriptDump(input: {
         isCast?: number | boolean;
         version?: number;
@@ -12,6 +12,7 @@ export type ProjectorRaysModule = {
     ) => unknown;
     HEAPU8?: Uint8Array;
     HEAPU32?: Uint32Array;
+    wasmMemory?: WebAssembly.Memory;
     _malloc?: (size: number) => number;
     _free?: (ptr: number) => void;
     ready?: Promise<void>;
@@ -1,7 +1,7 @@
 import { createRequire } from "node:module";
 import { type ProjectorRaysLoaderOptions } from "./loader";
 import { DirectorFileBase } from "./director-file-base";
-import { ReadInput } from ".";
+import { DirectorAsyncOptions, DirectorWriteOptions, ReadInput } from ".";
 
 const require = createRequire(import.meta.url);
 
@@ -35,9 +35,22 @@ export class DirectorFile extends DirectorFileBase {
      * Write the unprotected file contents to disk.
      * This is only available in Node.
      */
-    writeToFile(path: string): void {
-        const data = this.writeToBuffer();
+    writeToFile(path: string, options: DirectorWriteOptions = {}): void {
+        const data = this.writeToBuffer(options);
         const { writeFileSync } = require("node:fs") as typeof import("node:fs");
         writeFileSync(path, data);
     }
+
+    /**
+     * Write the unprotected file contents to disk without blocking the event loop.
+     * This is only available in Node.
+     */
+    async writeToFileAsync(
+        path: string,
+        options: DirectorWriteOptions & DirectorAsyncOptions = {}
+    ): Promise<void> {
+        const data = await this.writeToBufferAsync(options);
+        const { writeFile } = await import("node:fs/promises");
+        await writeFile(path, data);
+    }
 }
@@ -1,5 +1,6 @@
 declare module "node:fs/promises" {
     export function readFile(path: string): Promise<Uint8Array>;
+    export function writeFile(path: string, data: Uint8Array): Promise<void>;
 }
 
 declare module "node:fs" {
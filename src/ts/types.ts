@@ -43,3 +43,79 @@ export type DirectorScriptDump = {
     version: number;
     casts: DirectorScriptCast[];
 };
+
+export type DirectorWriteOptions = {
+    /**
+     * Reuse the input bytes of every chunk that was not edited and only regenerate the
+     * `imap`/`mmap`, instead of re-serializing the whole movie. Afterburner input is written out
+     * as plain RIFX with its chunks decompressed.
+     */
+    incremental?: boolean;
+    /**
+     * Write a compressed Afterburner movie (FGDM, or FGDC for casts) instead of plain RIFX.
+     * Chunks are deflated in parallel when the WASM build has thread support.
+     */
+    afterburner?: boolean;
+    /** With `incremental` or `afterburner`, also unprotect the movie. The full writer always does this. */
+    unprotect?: boolean;
+    /** With `incremental` or `afterburner`, also restore decompiled script text. The full writer always does this. */
+    restoreScripts?: boolean;
+    /** zlib level for `afterburner` output, 0-9. Defaults to zlib's default (6). */
+    compressionLevel?: number;
+    /** Number of compression threads for `afterburner` output. Defaults to one per core. */
+    threads?: number;
+    /**
+     * With `afterburner`, copy unmodified chunks of an Afterburner input in their original
+     * compressed form instead of decompressing and recompressing them.
+     */
+    keepCompressed?: boolean;
+};
+
+export type DirectorProgress = {
+    done: number;
+    total: number;
+};
+
+export type DirectorAsyncOptions = {
+    /** Cancel the operation; the returned promise rejects with the signal's reason. */
+    signal?: AbortSignal;
+    /** Called after every slice of work. */
+    onProgress?: (progress: DirectorProgress) => void;
+    /** How long each slice may run before yielding to the event loop, in ms. Defaults to 8. */
+    sliceMs?: number;
+};
+
+/**
+ * Cast member metadata as columns, one row per member. Names are UTF-8 slices of `strings`:
+ * member `i` is `strings.subarray(nameOffsets[i], nameOffsets[i + 1])`, and cast `c` likewise
+ * with `castNameOffsets`. Columns that don't apply to a member's type are 0.
+ */
+export type DirectorCastCatalog = {
+    length: number;
+    memberId: Int32Array;
+    /** Index into `castNames`. */
+    castIndex: Int32Array;
+    /** Director member type (1 = bitmap, 6 = sound, 11 = script, ...). */
+    type: Uint8Array;
+    /** Script type of script members (1 = score/behavior, 3 = movie, 7 = parent). */
+    scriptType: Uint8Array;
+    width: Int32Array;
+    height: Int32Array;
+    /** Bitmap bit depth. */
+    depth: Uint8Array;
+    /** Numeric fourCC of the chunk holding a sound member's samples (`snd `, `sndS` or `ediM`). */
+    soundMedia: Uint32Array;
+    /**
+     * Numeric OSType of a sound member's sample format: `raw ` or `twos` for uncompressed
+     * sound, or the codec (`MAC3`, `ima4`, ...). 0, like the rate, size and channel columns, when
+     * the header isn't parsed (`ediM` media) or fails to parse.
+     */
+    soundFormat: Uint32Array;
+    sampleRate: Int32Array;
+    sampleSize: Uint8Array;
+    channelCount: Uint8Array;
+    nameOffsets: Int32Array;
+    castNameOffsets: Int32Array;
+    strings: Uint8Array;
+    castNames: string[];
+};
@@ -0,0 +1,14 @@
+import type { ProjectorRaysModule } from "../loader";
+
+/**
+ * Point `HEAPU8`/`HEAPU32` at the current WASM memory. In a pthreads build the memory can grow
+ * on a worker thread, which leaves the main thread's views on the old, shorter buffer.
+ */
+export function refreshHeapViews(module: ProjectorRaysModule): void {
+    const memory = module.wasmMemory;
+    if (!memory || module.HEAPU8?.buffer === memory.buffer) {
+        return;
+    }
+    module.HEAPU8 = new Uint8Array(memory.buffer);
+    module.HEAPU32 = new Uint32Array(memory.buffer);
+}
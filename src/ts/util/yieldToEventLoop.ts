@@ -0,0 +1,22 @@
+/**
+ * Resolve on a later turn of the event loop, letting pending I/O, rendering and timers run.
+ */
+export function yieldToEventLoop(): Promise<void> {
+    const { setImmediate } = globalThis as {
+        setImmediate?: (callback: () => void) => unknown;
+    };
+    if (typeof setImmediate === "function") {
+        return new Promise((resolve) => setImmediate(resolve));
+    }
+    if (typeof MessageChannel === "function") {
+        return new Promise((resolve) => {
+            const channel = new MessageChannel();
+            channel.port1.onmessage = () => {
+                channel.port1.close();
+                resolve();
+            };
+            channel.port2.postMessage(null);
+        });
+    }
+    return new Promise((resolve) => setTimeout(resolve, 0));
+}